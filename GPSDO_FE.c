@@ -40,6 +40,7 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <util/atomic.h>
+#include <util/crc16.h>
 
 // Define this for the FE-405 variant. It runs at 15 MHz, has different
 // time constants and gain, and lacks an OSC_RDY output (it's always ready).
@@ -64,11 +65,28 @@
  *
  */
 
-// Turn on debug logging. Turn this off if you want to talk to the GPS
-// instead of listen to the debug log.
+// Turn on debug logging. Turn this (and EVENT_LOG) off if you want to talk
+// to the GPS instead of listen to the debug log.
 #define DEBUG
 
-#if defined(DEBUG)
+// When DEBUG is off, still send events (lock and mode changes, errors and
+// the like) as compact binary frames, the same as GPSDO_v4.c. Each one is an
+// ID from EVENT_LIST (in GPSDO_events.h) and its arguments, and the host
+// tools expand them.
+#define EVENT_LOG
+
+// Define this to add a third (drift) integrator to the PI loop. That makes
+// it a type-3 loop, which follows a steadily aging oscillator with no standing
+// phase error, and that in turn allows for longer time constants.
+//#define DRIFT_TERM
+
+#if defined(DEBUG) || !defined(__AVR_ATmega328PB__)
+// The debug log spells the events out already, and the ATTiny841 doesn't
+// have enough flash for the event log.
+#undef EVENT_LOG
+#endif
+
+#if defined(DEBUG) || defined(EVENT_LOG)
 // define this to include the serial transmit infrastructure at all
 #define SERIAL_TX
 // define this to make transmission interrupt driven and buffered rather than blocking
@@ -136,6 +154,15 @@
 // (that is, the last time the FLL determined the starting DAC value).
 #define DAMPING 1.75
 
+#ifdef DRIFT_TERM
+// The drift term's damping. It needs to be at least four times DAMPING
+// for the loop to stay well damped (the two integrator zeros stay real).
+#define DRIFT_DAMPING (4 * DAMPING)
+// The drift term only integrates while the average phase error is within
+// this many ns, so that it doesn't wind up during transients.
+#define DRIFT_WINDOW 10.0
+#endif
+
 // our DAC has a positive slope - higher values mean higher frequencies.
 // If you have an inverse DAC slope, set this to -1.
 #define DAC_SIGN (1)
@@ -148,6 +175,10 @@
 // phase discriminator value. The ATTiny841 doesn't have enough flash
 // for the extra code.
 #define QE_COMPENSATION 1.5
+#ifdef DEBUG
+// It can also tag each debug record with the UTC second it belongs to.
+#define UTC_TAG
+#endif
 #else
 // The ATTiny841 variant can switch from the internal osc to the external once it's ready
 #define OSC_SEL 1
@@ -220,6 +251,15 @@
 // to land at this value.
 #define PHASE_ADC_MIDPOINT 512
 
+// PPS captures are handed from the capture ISR to the main loop through a
+// ring of this many samples (it must be a power of two), so that if the main
+// loop falls behind, samples queue up instead of being overwritten.
+#ifdef __AVR_ATmega328PB__
+#define PPS_QUEUE_LEN 4
+#else
+#define PPS_QUEUE_LEN 2
+#endif
+
 // Note that if you ever want to parse a longer sentence, be sure to bump this up.
 // But an ATTiny841 only has 1/2K of RAM, so...
 #define RX_BUF_LEN (96)
@@ -235,8 +275,16 @@
 #define MODE_MED 2
 #define MODE_SLOW 3
 
+#ifdef DRIFT_TERM
+// The drift term only integrates in the long time constant modes.
+#define DRIFT_MIN_MODE MODE_MED
+#endif
+
 long last_dac_value;
 double iTerm;
+#ifdef DRIFT_TERM
+double dTerm;
+#endif
 double trim_value;
 double average_phase_error;
 double average_pps_error;
@@ -248,8 +296,24 @@ volatile unsigned long pps_count;
 volatile unsigned char gps_locked;
 volatile unsigned char rx_buf[RX_BUF_LEN];
 volatile unsigned char rx_str_len;
-volatile unsigned int irq_adc_value;
-volatile unsigned long irq_time_span;
+// The capture ISR only ever writes into free slots, and the main loop only
+// frees a slot once it's done reading it. The one exception is the QE, which
+// the receive ISR adds to the newest sample after the fact, and the main loop
+// won't read that sample until it has. When the ring is full, new samples
+// are dropped and counted.
+struct pps_sample {
+  unsigned long sequence; // the pps_count of this capture
+  unsigned long timestamp; // the extended Timer1 value at the capture
+  unsigned long span; // the timer counts since the previous (queued) capture
+  unsigned int adc; // the phase detector reading
+#ifdef QE_COMPENSATION
+  unsigned char qe_ready; // set once the QE for this PPS arrives
+  char qe[5]; // the receiver's quantization error for this PPS
+#endif
+};
+volatile struct pps_sample pps_queue[PPS_QUEUE_LEN];
+volatile unsigned char pps_queue_head, pps_queue_tail;
+volatile unsigned int pps_overruns;
 unsigned char last_osc_locked;
 unsigned char last_gps_locked;
 #ifdef DEBUG
@@ -257,8 +321,10 @@ volatile unsigned char pdop_buf[5];
 volatile unsigned char time_buf[7];
 volatile unsigned char date_buf[7];
 #endif
-#ifdef QE_COMPENSATION
-volatile unsigned char pps_err_buf[5];
+#ifdef UTC_TAG
+volatile unsigned char time_fresh;
+volatile unsigned long time_pps_count;
+unsigned long utc_second;
 #endif
 #ifdef SERIAL_TX
 // serial transmit buffer setup
@@ -375,16 +441,26 @@ ISR(TIMER1_CAPT_vect) {
   while(ADCSRA & _BV(ADSC)) ; // don't pet the watchdog - this should never take that long.
   unsigned int adc_value = ADC;
 
-  irq_adc_value = adc_value;
-
-  irq_time_span = timer_val - last_timer_val;
-  last_timer_val = timer_val;
+  pps_count++;
 
+  unsigned char next = (pps_queue_head + 1) & (PPS_QUEUE_LEN - 1);
+  if (next == pps_queue_tail) {
+    // The main loop is too far behind. Drop this one, but leave last_timer_val
+    // alone so the next sample's span covers it (it'll show up as XXS).
+    pps_overruns++;
+    return;
+  }
+  volatile struct pps_sample *sample = &(pps_queue[pps_queue_head]);
+  sample->sequence = pps_count;
+  sample->timestamp = timer_val;
+  sample->span = timer_val - last_timer_val;
+  sample->adc = adc_value;
 #ifdef QE_COMPENSATION
-  pps_err_buf[0] = 0; // The *next* sawtooth msg applies to *this* pps.
+  sample->qe_ready = 0; // The *next* sawtooth msg applies to *this* pps.
 #endif
+  pps_queue_head = next;
 
-  pps_count++;
+  last_timer_val = timer_val;
 
 }
 
@@ -458,6 +534,7 @@ static void tx_char(const char c) {
 #endif
 }
 
+#ifdef DEBUG
 static void tx_pstr(const char *buf) {
   for(int i = 0; i < strlen_P(buf); i++)
     tx_char(pgm_read_byte(&(buf[i])));
@@ -467,6 +544,45 @@ static void tx_str(const char *buf) {
   for(int i = 0; i < strlen(buf); i++)
     tx_char(buf[i]);
 }
+#endif
+
+#ifdef EVENT_LOG
+#include "GPSDO_events.h"
+
+// Binary frames are a sync byte, a type byte, a payload length byte, the
+// payload, then the CRC-CCITT (initial value 0xffff) of the type, length
+// and payload bytes, low byte first. This is the same framing as
+// GPSDO_v4.c's, so the same host tools read it.
+#define FRAME_SYNC 0xa5
+
+static void tx_frame(const unsigned char type, const void *payload, const unsigned char len) {
+  uint16_t crc = 0xffff;
+  tx_char(FRAME_SYNC);
+  tx_char(type);
+  crc = _crc_ccitt_update(crc, type);
+  tx_char(len);
+  crc = _crc_ccitt_update(crc, len);
+  for(int i = 0; i < len; i++) {
+    unsigned char c = ((const unsigned char *)payload)[i];
+    tx_char(c);
+    crc = _crc_ccitt_update(crc, c);
+  }
+  tx_char(crc & 0xff);
+  tx_char(crc >> 8);
+}
+
+static void log_event(const unsigned char id, const long a, const long b, const long c) {
+  struct event_frame frame;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    frame.pps = pps_count;
+  }
+  frame.id = id;
+  frame.args[0] = a;
+  frame.args[1] = b;
+  frame.args[2] = c;
+  tx_frame('E', &frame, offsetof(struct event_frame, args) + sizeof(frame.args[0]) * pgm_read_byte(&(event_args[id])));
+}
+#endif
 
 #endif
 
@@ -514,10 +630,41 @@ static inline void handleGPS() {
     if (ptr == NULL) return; // not enough commas
     strncpy((char *)time_buf, ptr, 6);
     time_buf[sizeof(time_buf) - 1] = 0;
-    ptr = skip_commas(ptr, 8);
+    ptr = skip_commas(ptr, 1);
+    if (ptr == NULL) return; // not enough commas
+    unsigned char valid = (*ptr == 'A');
+    ptr = skip_commas(ptr, 7);
     if (ptr == NULL) return; // not enough commas
     strncpy((char *)date_buf, ptr, 6);
     date_buf[sizeof(date_buf) - 1] = 0;
+#ifdef UTC_TAG
+    if (valid) {
+      // The time in this sentence belongs to the PPS that preceded it.
+      time_pps_count = pps_count;
+      time_fresh = 1;
+    }
+#else
+    (void)valid;
+#endif
+#endif
+#ifdef UTC_TAG
+  } else if (!strncmp_P((const char*)rx_buf, PSTR("$GPZDA"), 6)) {
+    // $GPZDA,172313.000,26,05,2016,00,00*5B
+    ptr = skip_commas(ptr, 1);
+    if (ptr == NULL || *ptr == ',') return; // not enough commas, or no time yet
+    strncpy((char *)time_buf, ptr, 6);
+    time_buf[sizeof(time_buf) - 1] = 0;
+    // Rearrange the day, month and year fields into RMC's ddmmyy form.
+    for(int j = 0; j < 3; j++) {
+      ptr = skip_commas(ptr, 1);
+      if (ptr == NULL) return; // not enough commas
+      if (j == 2) ptr += 2; // only the last two digits of the year
+      date_buf[j * 2] = ptr[0];
+      date_buf[j * 2 + 1] = ptr[1];
+    }
+    date_buf[sizeof(date_buf) - 1] = 0;
+    time_pps_count = pps_count;
+    time_fresh = 1;
 #endif
   } else if (!strncmp_P((const char*)rx_buf, PSTR("$GPGSA"), 6)) {
     // $GPGSA,A,3,02,06,12,24,25,29,,,,,,,1.61,1.33,0.90*01
@@ -539,14 +686,41 @@ static inline void handleGPS() {
     // $PSTI,00,2,0,5.8,,*3F
     ptr = skip_commas(ptr, 4);
     if (ptr == NULL) return; // not enough commas
+    if (pps_queue_head == pps_queue_tail) return; // the latest PPS has already been handled
+    volatile struct pps_sample *sample = &(pps_queue[(pps_queue_head - 1) & (PPS_QUEUE_LEN - 1)]);
+    if (sample->qe_ready) return; // we already have one for this PPS
     unsigned char len = (strchr((const char *)ptr, ',')) - ptr;
-    if (len > sizeof(pps_err_buf) - 1) len = sizeof(pps_err_buf) - 1; // truncate if too long
-    memcpy((void*)pps_err_buf, ptr, len);
-    pps_err_buf[len] = 0; // null terminate
+    if (len > sizeof(sample->qe) - 1) len = sizeof(sample->qe) - 1; // truncate if too long
+    memcpy((void*)sample->qe, ptr, len);
+    sample->qe[len] = 0; // null terminate
+    sample->qe_ready = 1;
   }
 #endif
 }
 
+#ifdef UTC_TAG
+// Days in the year before the first of each month (non-leap years).
+const unsigned int month_days[] PROGMEM = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+static unsigned char two_digits(const char *ptr) {
+  if (ptr[0] < '0' || ptr[0] > '9' || ptr[1] < '0' || ptr[1] > '9') return 0xff;
+  return (ptr[0] - '0') * 10 + (ptr[1] - '0');
+}
+
+// Turn an NMEA ddmmyy date and hhmmss time into seconds since the
+// Unix epoch. Two digit years are 20xx. Returns 0 if either is malformed.
+static unsigned long nmea_to_utc(const char *date, const char *time) {
+  unsigned char day = two_digits(date), month = two_digits(date + 2), year = two_digits(date + 4);
+  unsigned char hour = two_digits(time), min = two_digits(time + 2), sec = two_digits(time + 4);
+  if (day == 0 || day > 31 || month == 0 || month > 12 || year > 99) return 0;
+  if (hour > 23 || min > 59 || sec > 60) return 0;
+  // 2000 was a leap year, so (year + 3) / 4 is the count of leap days before this year.
+  unsigned int days = 365U * year + (year + 3) / 4 + pgm_read_word(&(month_days[month - 1])) + day - 1;
+  if ((year & 3) == 0 && month > 2) days++; // we're past this year's leap day
+  return 946684800UL + days * 86400UL + hour * 3600UL + min * 60U + sec;
+}
+#endif
+
 // Optimization beyond O2 turns this into a jump table, which is a step backwards
 // on a Harvard machine.
 static unsigned __attribute__((optimize("O1"))) int mode_to_tc(const unsigned char mode) {
@@ -568,8 +742,14 @@ static void reset_pll() {
     // if we're exiting the PLL, then at least take the most recent
     // adjustment value we had and add it back to the trim value for free-running.
     trim_value -= iTerm / mode_to_tc(mode);
+#ifdef DRIFT_TERM
+    trim_value -= dTerm / mode_to_tc(mode);
+#endif
   }
   iTerm = 0.;
+#ifdef DRIFT_TERM
+  dTerm = 0.;
+#endif
   average_phase_error = 0.;
   average_pps_error = 0.;
   mode = MODE_START;
@@ -582,6 +762,9 @@ static void downgrade_mode() {
   // translate the iTerm whenever we change the time constant.
   double ratio = ((double)mode_to_tc(mode))/((double)mode_to_tc(mode + 1));
   iTerm *= ratio;
+#ifdef DRIFT_TERM
+  dTerm *= ratio;
+#endif
 }
 
 #ifdef __AVR_ATmega328PB__
@@ -684,8 +867,8 @@ void __ATTR_NORETURN__ main() {
 // systems are allowed to talk to it. UART1 (both TX and RX) go to the oscillator
 // module.
 
-// We don't ever transmit anything when DEBUG is off.
-#ifdef DEBUG
+// We don't ever transmit anything when DEBUG and EVENT_LOG are off.
+#ifdef SERIAL_TX
   UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0); // transmit always for debug
 #else
   UCSR0B = _BV(RXCIE0) | _BV(RXEN0);
@@ -733,6 +916,8 @@ void __ATTR_NORETURN__ main() {
   DIDR0 = _BV(ADC0D); // disable digital I/O on pin A0.
 
   pps_count = 0;
+  pps_queue_head = pps_queue_tail = 0;
+  pps_overruns = 0;
   mode = MODE_START;
   reset_pll();
   gps_locked = 0;
@@ -748,15 +933,14 @@ void __ATTR_NORETURN__ main() {
   // initialize to ""
   *date_buf = 0;
   *time_buf = 0;
+  *pdop_buf = 0;
 #endif
-#ifdef SERIAL_TX
-  *pdop_buf = 0; // null terminate
-#ifdef QE_COMPENSATION
-  *pps_err_buf = 0; // null terminate
+#ifdef UTC_TAG
+  time_fresh = 0;
+  utc_second = 0; // unknown until the first valid $GPRMC or $GPZDA
 #endif
 #ifdef IRQ_DRIVEN_TX
   txbuf_head = txbuf_tail = 0; // clear the transmit buffer
-#endif
 #endif
 
   sei();
@@ -770,6 +954,8 @@ void __ATTR_NORETURN__ main() {
   if (mcusr_value & _BV(EXTRF)) tx_pstr(PSTR("RES_EXT\r\n")); // external reset
   if (mcusr_value & _BV(BORF)) tx_pstr(PSTR("RES_BO\r\n")); // brown-out reset
   if (mcusr_value & _BV(WDRF)) tx_pstr(PSTR("RES_WD\r\n")); // watchdog reset
+#elif defined(EVENT_LOG)
+  log_event(EV_START, mcusr_value, 0, 0);
 #endif
 
   last_dac_value = 0x7fffffffL; // unlikely
@@ -812,7 +998,9 @@ skip:
 #endif
 
   while(1) {
+#ifdef UTC_TAG
     static unsigned long last_pps_count = 0;
+#endif
  
     // Pet the dog
     do_wdt_reset();
@@ -828,10 +1016,14 @@ skip:
       if (gps_locked) {
 #ifdef DEBUG
         tx_pstr(PSTR("G_LK\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_G_LK, 0, 0, 0);
 #endif
       } else {
 #ifdef DEBUG
         tx_pstr(PSTR("G_UN\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_G_UN, 0, 0, 0);
 #endif
         // Whenever the GPS unlocks, back down one PLL time constant step. We don't
 	// attempt to track how long we've held over, but a faster TC means less averaging,
@@ -847,10 +1039,14 @@ skip:
       if (osc_locked) {
 #ifdef DEBUG
         tx_pstr(PSTR("FE_LK\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_FE_LK, 0, 0, 0);
 #endif
       } else {
 #ifdef DEBUG
         tx_pstr(PSTR("FE_UN\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_FE_UN, 0, 0, 0);
 #endif
         writeDacValue(0, 0);
         reset_pll();
@@ -903,6 +1099,9 @@ skip:
 #endif
 #ifdef DEBUG
       tx_pstr(PSTR("CK_OK\r\n\r\n"));
+#elif defined(EVENT_LOG)
+      // Sent now rather than before the switch, so it's at the right baud rate.
+      log_event(EV_CK_SW, 0, 0, 0);
 #endif
     }
 #endif
@@ -956,30 +1155,73 @@ skip:
 #ifdef __AVR_ATmega328PB__
     if (check_buttons() && mode == MODE_SLOW && button_blink_time == 0) {
       // Do a non-volatile write and blink the LEDs to celebrate
+      long dac_value = (long)(DAC_SIGN * trim_value);
 #ifdef DEBUG
       tx_pstr(PSTR("\r\nEE_WR\r\n\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_EE_WR, dac_value, 0, 0);
 #endif
-      long dac_value = (long)(DAC_SIGN * trim_value);
       writeDacValue(dac_value, 1);
       button_blink_time = timer_hibits;
       if (!button_blink_time) button_blink_time++; // it cannot be set to 0.
     }
 #endif
 
-    // If we haven't had a PPS event since we were last here, we're done.
-    if (last_pps_count == pps_count) continue;
+    // If there's no PPS sample waiting, we're done.
+    unsigned char tail = pps_queue_tail;
+    if (tail == pps_queue_head) continue;
+    unsigned char next_tail = (tail + 1) & (PPS_QUEUE_LEN - 1);
 #ifdef QE_COMPENSATION
-    // if there hasn't been a quantization error sentence for this second, wait for it.
-    if (pps_err_buf[0] == 0) continue;
+    // If the only one waiting hasn't had its quantization error sentence yet,
+    // wait for it. If it's not the newest one, though, its QE isn't coming.
+    if (next_tail == pps_queue_head && !pps_queue[tail].qe_ready) continue;
+#endif
+    struct pps_sample capture;
+    memcpy(&capture, (const void *)&(pps_queue[tail]), sizeof(capture));
+    pps_queue_tail = next_tail;
+#ifdef UTC_TAG
+    last_pps_count = capture.sequence;
 #endif
-    last_pps_count = pps_count;
 
 #ifdef DEBUG
     {
       char temp_date_buf[7], temp_time_buf[7];
+#ifdef UTC_TAG
+      unsigned char fresh;
+      unsigned long anchor_pps_count, span = capture.span;
+#endif
       ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         strcpy(temp_date_buf, (char *)date_buf);
         strcpy(temp_time_buf, (char *)time_buf);
+#ifdef UTC_TAG
+        fresh = time_fresh;
+        time_fresh = 0;
+        anchor_pps_count = time_pps_count;
+#endif
+      }
+#ifdef UTC_TAG
+      // Every record is tagged with the UTC second of its PPS. Between
+      // time sentences (and through holdover), we carry it forward by
+      // the number of whole seconds this capture spanned.
+      if (utc_second != 0) utc_second += (span + F_CPU / 2) / F_CPU;
+      if (fresh) {
+        unsigned long anchor = nmea_to_utc(temp_date_buf, temp_time_buf);
+        if (anchor != 0) utc_second = anchor + (last_pps_count - anchor_pps_count);
+      }
+#endif
+      static unsigned int last_pps_overruns = 0;
+      unsigned int overruns;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        overruns = pps_overruns;
+      }
+      if (overruns != last_pps_overruns) {
+        char buf[8];
+        // OVR = the running count of PPS samples dropped because the main loop fell behind.
+        last_pps_overruns = overruns;
+        tx_pstr(PSTR("OVR="));
+        utoa(overruns, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
       }
       if (strlen(temp_date_buf) > 0 && strlen(temp_time_buf) > 0) {
         tx_pstr(PSTR("DT="));
@@ -988,6 +1230,28 @@ skip:
         tx_str(temp_time_buf);
         tx_pstr(PSTR("\r\n"));
       }
+#ifdef UTC_TAG
+      if (utc_second != 0) {
+        char buf[12];
+        // TS = Time Stamp - the UTC second (Unix time) of the PPS this record describes.
+        tx_pstr(PSTR("TS="));
+        ultoa(utc_second, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
+      }
+#endif
+    }
+#elif defined(EVENT_LOG)
+    {
+      static unsigned int last_pps_overruns = 0;
+      unsigned int overruns;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        overruns = pps_overruns;
+      }
+      if (overruns != last_pps_overruns) {
+        last_pps_overruns = overruns;
+        log_event(EV_OVR, overruns, 0, 0);
+      }
     }
 #endif
 
@@ -995,31 +1259,26 @@ skip:
 #ifdef DEBUG
       // FR - Free Running - GPS or osc is unlocked.
       tx_pstr(PSTR("FR\r\n\r\n"));
-#endif
-#ifdef QE_COMPENSATION
-      pps_err_buf[0] = 0; // clear it out.
 #endif
       continue;
     }
 
 #ifdef QE_COMPENSATION
+    // A sample whose QE never showed up can't be used.
+    if (!capture.qe_ready) continue;
+
     double pps_err;
     {
-      char temp[5];
-      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        strcpy(temp, (const char*) pps_err_buf); // it's volatile, so make a copy atomically.
-        pps_err_buf[0] = 0; // clear it out.
-      }
 #ifdef DEBUG
       tx_pstr(PSTR("QE="));
-      tx_str(temp);
+      tx_str(capture.qe);
       tx_pstr(PSTR("\r\n"));
 #endif
-      pps_err = atof(temp);
+      pps_err = atof(capture.qe);
     }
 #endif
 
-    long pps_cycle_delta = irq_time_span - F_CPU;
+    long pps_cycle_delta = capture.span - F_CPU;
 
     // round to the nearest second. It's impossible for this to
     // wind up being negative, given reasonably correct GPS behavior.
@@ -1042,6 +1301,8 @@ skip:
       ltoa(seconds_delta, buf, 10);
       tx_str(buf);
       tx_pstr(PSTR("\r\n\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_XXI, intracycle_delta, seconds_delta, 0);
 #endif
       continue;
     }
@@ -1055,6 +1316,8 @@ skip:
       ltoa(seconds_delta, buf, 10);
       tx_str(buf);
       tx_pstr(PSTR("\r\n\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_XXS, seconds_delta, 0, 0);
 #endif
     }
 
@@ -1063,7 +1326,7 @@ skip:
     // Since our ADC is 10 bits and the pulse is a microsecond wide we can fudge a little
     // and claim that each ADC count is one nanosecond. So current and average phase error
     // is in nanoseconds and is wrapped.
-    int current_phase_error = PHASE_ADC_MIDPOINT - irq_adc_value;
+    int current_phase_error = PHASE_ADC_MIDPOINT - capture.adc;
 
 #ifdef QE_COMPENSATION
     current_phase_error += (int)((QE_COMPENSATION * pps_err) + 0.5); // quant error correction is in ns. Round to nearest
@@ -1085,7 +1348,7 @@ skip:
     {
       char buf[8];
       tx_pstr(PSTR("ADC="));
-      itoa(irq_adc_value, buf, 10);
+      itoa(capture.adc, buf, 10);
       tx_str(buf);
       tx_pstr(PSTR("\r\nMOD="));
       itoa(mode, buf, 10);
@@ -1135,6 +1398,8 @@ skip:
           exit_timer = 0;
 #ifdef DEBUG
           tx_pstr(PSTR("M_FAST\r\n\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_M_FAST, 0, 0, 0);
 #endif
           continue;
         }
@@ -1152,6 +1417,8 @@ skip:
       dtostrf(average_pps_error, 7, 2, buf);
       tx_str(buf);
       tx_pstr(PSTR("\r\nM_START\r\n\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_M_START, lround(average_pps_error * 100), 0, 0);
 #endif
       reset_pll();
       continue;
@@ -1177,8 +1444,13 @@ skip:
           // translate the iTerm whenever we change the time constant.
           double ratio = ((double)time_constant)/((double)mode_to_tc(mode - 1));
           iTerm *= ratio;
+#ifdef DRIFT_TERM
+          dTerm *= ratio;
+#endif
 #ifdef DEBUG
           tx_pstr(PSTR("M_UP\r\n\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_M_UP, mode, 0, 0);
 #endif
         }
       } else {
@@ -1195,6 +1467,8 @@ skip:
           time_constant = mode_to_tc(mode);
 #ifdef DEBUG
           tx_pstr(PSTR("M_DN\r\n\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_M_DN, mode, 0, 0);
 #endif
       }
     }
@@ -1220,7 +1494,17 @@ skip:
     double pTerm = average_phase_error * GAIN;
     iTerm += pTerm / (time_constant * DAMPING);
 
+#ifdef DRIFT_TERM
+    // The drift term integrates the iTerm. That's what lets the loop follow a
+    // steady frequency drift with no standing phase error: the iTerm settles
+    // at whatever value makes the drift term ramp at the drift rate.
+    if (mode >= DRIFT_MIN_MODE && fabs(average_phase_error) <= DRIFT_WINDOW) {
+      dTerm += iTerm / (time_constant * DRIFT_DAMPING);
+    }
+    double adj_val = (pTerm + iTerm + dTerm) / time_constant;
+#else
     double adj_val = (pTerm + iTerm) / time_constant;
+#endif
 
     // For the PLL, the trim_value we calculated during the FLL stays put
     // and the adj_val we've computed will be relative to that.
@@ -1236,11 +1520,27 @@ skip:
     if (fabs(iTerm) > iTerm_modulo) {
 #ifdef DEBUG
         tx_pstr(PSTR("RED\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_RED, (iTerm < 0) ? 1000 : -1000, 0, 0);
 #endif
         int sign = (iTerm < 0)?-1:1;
         iTerm -= sign * iTerm_modulo;
         trim_value -= sign * 1000;
     }
+#ifdef DRIFT_TERM
+    // Under steady aging it's the drift term that accumulates, so it
+    // gets off-loaded the same way.
+    if (fabs(dTerm) > iTerm_modulo) {
+#ifdef DEBUG
+        tx_pstr(PSTR("RED\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_RED, (dTerm < 0) ? 1000 : -1000, 1, 0);
+#endif
+        int sign = (dTerm < 0)?-1:1;
+        dTerm -= sign * iTerm_modulo;
+        trim_value -= sign * 1000;
+    }
+#endif
 
 #ifdef DEBUG
     {
@@ -1251,6 +1551,11 @@ skip:
       tx_pstr(PSTR("\r\niT="));
       dtostrf(iTerm, 7, 2, buf);
       tx_str(buf);
+#ifdef DRIFT_TERM
+      tx_pstr(PSTR("\r\ndT="));
+      dtostrf(dTerm, 7, 2, buf);
+      tx_str(buf);
+#endif
 #ifdef __AVR_ATmega328PB__
       // AV = Adjustment Value - the delta being applied right now to the TP
       tx_pstr(PSTR("\r\nAV="));
@@ -0,0 +1,81 @@
+/*
+
+    GPSDO event log IDs
+    Copyright (C) 2015 Nicholas W. Sayer
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    
+  */
+
+// The events the firmware sends as 'E' frames when EVENT_LOG is on. This is
+// included by each firmware that has EVENT_LOG, after avr/pgmspace.h.
+
+#ifndef GPSDO_EVENTS_H
+#define GPSDO_EVENTS_H
+
+// Every event, with its ID, its name, and how many (32 bit) arguments it
+// carries. Not every firmware sends every event (FE_LK and the rest of the
+// ones at the end are GPSDO_FE.c's). The host tools' dictionary is
+// generated from this list (see tools/Makefile), so add new ones at the end
+// and never renumber them.
+#define EVENT_LIST(X) \
+  X(1, START, 1) /* the reset cause (the MCUSR bits) */ \
+  X(2, STALL, 3) /* the stuck address (or -1), the ISR and the loop stage */ \
+  X(3, CKPT, 2) /* the restored trim value * 100, the mode it was saved in */ \
+  X(4, G_LK, 0) \
+  X(5, G_UN, 0) \
+  X(6, PWR_FAIL, 1) /* the supply voltage in mV */ \
+  X(7, PWR_OK, 0) \
+  X(8, OSC, 1) /* the oscillator frequency in Hz */ \
+  X(9, OVR, 1) /* the running count of dropped PPS captures */ \
+  X(10, TXD, 1) /* the running count of dropped transmit characters */ \
+  X(11, SV, 1) /* the new survey state */ \
+  X(12, SV_SAVED, 0) \
+  X(13, XXI, 2) /* the intracycle delta, the seconds delta */ \
+  X(14, XXS, 1) /* the seconds delta */ \
+  X(15, WU_DONE, 1) /* how many warm-up windows it took */ \
+  X(16, HB_ON, 0) \
+  X(17, HB_OFF, 0) \
+  X(18, M_FAST, 0) \
+  X(19, M_START, 1) /* the average PPS error * 100 */ \
+  X(20, M_UP, 1) /* the new mode */ \
+  X(21, M_DN, 1) /* the new mode */ \
+  X(22, JMP, 1) /* the frequency jump in ppb * 100 */ \
+  X(23, JMP_DONE, 0) \
+  X(24, RED, 2) /* the change to the trim value, and 0 for the iTerm or 1 for the dTerm */ \
+  X(25, AID, 3) /* the latitude and longitude (in 1/100 degrees) and altitude (in m) given to the receiver */ \
+  X(26, BAUD, 2) /* the receiver's baud rate, and its protocol (0 NMEA, 1 UBX) */ \
+  X(27, BAUD_LOST, 0) \
+  X(28, GLT, 1) /* the running count of PPS edges thrown away as glitches */ \
+  X(29, FE_LK, 0) \
+  X(30, FE_UN, 0) \
+  X(31, CK_SW, 0) /* switched to the external oscillator */ \
+  X(32, EE_WR, 1) /* the DAC value written to the oscillator's non-volatile memory */
+
+#define EVENT_ID(id, name, args) EV_##name = id,
+enum { EVENT_LIST(EVENT_ID) };
+#define EVENT_ARGS(id, name, args) [id] = args,
+const unsigned char event_args[] PROGMEM = { EVENT_LIST(EVENT_ARGS) };
+
+// 'E' - sent for every event. Only as many args are sent as the event has.
+// The types are fixed-size, and it's packed, so that the simulator's host
+// build of the firmware sends the same layout.
+struct event_frame {
+  uint32_t pps; // the PPS count when it happened
+  uint8_t id;
+  int32_t args[3];
+} __attribute__((packed));
+
+#endif
@@ -63,6 +63,9 @@
 // Define this for the OH300 variant, undef for DOT050V
 #define OH300
 
+// Define this to hold off discipline until the oscillator's oven has warmed up.
+#define WARMUP
+
 #if defined(DEBUG) || defined(WAAS)
 // define this to include the serial transmit infrastructure at all
 #define SERIAL_TX
@@ -156,6 +159,19 @@
 #define RX_BUF_LEN (96)
 #define TX_BUF_LEN (128)
 
+#ifdef WARMUP
+// While the oven warms up, the oscillator frequency moves too quickly for the
+// FLL to chase. Instead, we measure it over WARMUP_WINDOW seconds at a time.
+// Once it moves by no more than WARMUP_DRIFT ppb from one window to the next
+// for WARMUP_STABLE windows in a row, we start the FLL. In the meantime, the
+// DAC is pre-positioned to where the drift says the frequency is heading.
+// If it never settles, we give up waiting after WARMUP_MAX_WINDOWS.
+#define WARMUP_WINDOW 60
+#define WARMUP_DRIFT 5.0
+#define WARMUP_STABLE 2
+#define WARMUP_MAX_WINDOWS 30
+#endif
+
 // The start mode watches the cycle count error over a 10 second window, and
 // adjusts the DAC until a minute goes by without any errors.
 #define MODE_START 0
@@ -178,6 +194,14 @@ double average_pps_error;
 unsigned char mode;
 unsigned char last_gps_locked;
 unsigned int exit_timer;
+#ifdef WARMUP
+unsigned char warming_up;
+unsigned char warmup_windows;
+unsigned char warmup_stable;
+unsigned int warmup_seconds;
+long warmup_cycles;
+double warmup_last_freq;
+#endif
 volatile unsigned int timer_hibits;
 volatile unsigned long pps_count;
 volatile unsigned char gps_locked;
@@ -573,6 +597,13 @@ void main() {
 
   // the default value of the DAC is midpoint, so nothing needs to be done.
   trim_value = 0.;
+#ifdef WARMUP
+  warming_up = 1;
+  warmup_windows = 0;
+  warmup_stable = 0;
+  warmup_seconds = 0;
+  warmup_cycles = 0;
+#endif
 
   sei();
 
@@ -692,6 +723,73 @@ void main() {
 #endif
     }
 
+#ifdef WARMUP
+    if (warming_up) {
+      // Add up the cycle count error over the window. A missed PPS just
+      // makes the window that much longer.
+      warmup_cycles += intracycle_delta;
+      warmup_seconds += seconds_delta + 1;
+#ifdef DEBUG
+      {
+        char buf[8];
+        // WU = Warm-Up - how far we are into the current warm-up window.
+        tx_pstr(PSTR("WU="));
+        utoa(warmup_seconds, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n\r\n"));
+      }
+#endif
+      if (warmup_seconds < WARMUP_WINDOW) continue;
+
+      // This is the frequency error in ppb the oscillator would have with the DAC
+      // at its midpoint. Taking the trim value out means our own pre-positioning
+      // doesn't show up as drift.
+      double freq = (1000000000.0 / F_CPU) * warmup_cycles / warmup_seconds - trim_value / GAIN;
+      double drift = freq - warmup_last_freq;
+      if (warmup_windows++ == 0) {
+        drift = 0.; // we need two windows to see a drift rate.
+      } else if (fabs(drift) <= WARMUP_DRIFT) {
+        warmup_stable++;
+      } else {
+        warmup_stable = 0;
+      }
+      warmup_last_freq = freq;
+      warmup_cycles = 0;
+      warmup_seconds = 0;
+
+      // Set the DAC for where the frequency will be by the middle of the next window.
+      trim_value = -GAIN * (freq + drift);
+      if (trim_value > 0x7fff) trim_value = 0x7fff;
+      if (trim_value < -0x7fff) trim_value = -0x7fff;
+      unsigned int dac_value = (int)(DAC_SIGN * trim_value) + 0x8000;
+      writeDacValue(dac_value);
+#ifdef DEBUG
+      {
+        char buf[10];
+        // WUF = the frequency error with the DAC at midpoint, WUD = how much it moved since the last window.
+        tx_pstr(PSTR("WUF="));
+        dtostrf(freq, 7, 2, buf);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\nWUD="));
+        dtostrf(drift, 7, 2, buf);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\nDAC=0x"));
+        itoa(dac_value, buf, 16);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n\r\n"));
+      }
+#endif
+      if (warmup_stable >= WARMUP_STABLE || warmup_windows >= WARMUP_MAX_WINDOWS) {
+        // The FLL takes it from here, starting with the DAC where we left it.
+        warming_up = 0;
+#ifdef DEBUG
+        tx_pstr(PSTR("WU_DONE\r\n\r\n"));
+#endif
+      }
+      continue;
+    }
+#endif
+
     // the time constant in START mode is the same as FAST mode.
     unsigned int time_constant = mode_to_tc(mode);
 
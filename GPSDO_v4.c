@@ -38,6 +38,7 @@
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
 #include <util/atomic.h>
+#include <util/crc16.h>
 
 // 10 MHz.
 #define F_CPU (10000000UL)
@@ -53,26 +54,156 @@
  *
  */
 
-// Turn on debug logging. Turn this off if you want to talk to the GPS
-// instead of listen to the debug log.
+// Turn on debug logging. Turn this (and EVENT_LOG) off if you want to talk
+// to the GPS instead of listen to the debug log.
 #define DEBUG
 
+// When DEBUG is off, still send events (lock and mode changes, errors and
+// the like) as compact binary frames. Each one is an ID from EVENT_LIST
+// (in GPSDO_events.h) and its arguments, and the host tools expand them.
+#define EVENT_LOG
+
 // Define this for the OH300 variant, undef for DOT050V
 #define OH300
 
+// Define this to add a third (drift) integrator to the PI loop. That makes
+// it a type-3 loop, which follows a steadily aging oscillator with no standing
+// phase error, and that in turn allows for longer time constants.
+//#define DRIFT_TERM
+
+// Define this to hold off discipline until the oscillator's oven has warmed up.
+// In the simulator it doesn't pay for itself on a cold start (the fast lock
+// comes later, and it settles no sooner), so it's off by default.
+//#define WARMUP
+
+// Define this to run the watchdog in interrupt-then-reset mode. When it
+// first times out, its interrupt records where the code was stuck in RAM
+// that survives the reset, and that gets logged after the reboot.
+#define STALL_TRACE
+
+// Define this to watch the supply voltage and, if it starts to fail, save
+// the loop's state to EEPROM so that the next power-up can start from it.
+#define POWER_FAIL
+
+// Define this to keep glitches on the PPS line out of the loop. The capture
+// input's noise canceler is turned on, pulses that are too short are
+// thrown away, and so are edges that come too soon after the last PPS.
+#define PPS_FILTER
+
+// Define this to watch the receiver's QE for a "hanging bridge" (see
+// HB_FILTER below), and while one lasts, to keep the rounding of the QE
+// correction from adding up to a slow phase wander.
+#define HANGING_BRIDGE
+
+// Define this to watch for sudden steps in the oscillator's frequency while
+// in the slow mode, and to correct for them right away rather than waiting
+// for the long time constant to catch up.
+//#define JUMP_DETECT
+
+// Define this to slowly sweep the phase setpoint back and forth across a few
+// ADC codes while in the slow mode. Otherwise the loop sits on the same few
+// codes, and their differential nonlinearity becomes a phase bias.
+//#define PHASE_DITHER
+
+// Define this to turn the board into a frequency / time interval counter
+// for characterizing an oscillator against GPS. The DAC is parked at
+// MEASURE_DAC and never steered, and instead of the debug log, binary
+// measurement frames are sent (see tx_frame() below).
+//#define MEASURE
+
+// Define this to send the loop's inputs - each PPS capture, just as the
+// loop gets it - as binary frames in place of the debug log (see struct
+// raw_sample below). The loop runs as usual, and a capture from a unit in
+// service can be replayed into any other build of the firmware on the host
+// with tools/gpsdo_sim -r.
+//#define RAW_CAPTURE
+
+// Define this to measure the oscillator's frequency against the first PPS
+// intervals at startup and snap it to the nearest one in osc_freqs[] below,
+// instead of assuming F_CPU. One image then runs with any of them. Until
+// the frequency is known, the serial port runs at the baud rate F_CPU would
+// give, which for any other oscillator means the log is garbled.
+//#define AUTO_F_CPU
+
+// Define this to find the receiver's baud rate at startup, instead of
+// assuming BAUD. Each of baud_rates[] below is tried until valid NMEA
+// sentences come in, and the one that works is saved in EEPROM and tried
+// first the next time. The log shares the serial port, so it's garbled
+// while the search is on, and it runs at the receiver's baud rate after.
+//#define AUTO_BAUD
+
+// Define this to have the firmware manage a SkyTraq timing receiver's
+// position. On first boot, the receiver is put into survey-in. When it has
+// switched itself to static (position hold) timing mode, the surveyed
+// position is saved in EEPROM, and on later boots the receiver is put
+// straight into static mode with it. This needs the serial TX line to be
+// connected to the receiver. Erase the EEPROM to force a new survey.
+//#define SURVEY
+
+// Define this to help a SkyTraq receiver to its first fix sooner. The last
+// position it reported (and the time) are kept in EEPROM, and at startup,
+// the receiver is restarted with them as hints (the time only if it was
+// saved as the power failed, just before the reset). This needs the serial
+// TX line to be connected to the receiver.
+//#define AIDING
+
+// Define this for a board with the 20 bit AD5791 DAC in place of the
+// variant's usual one. The loop's gain follows the DAC's resolution.
+//#define AD5791
+
 // Older hardware had the DIN pin of the DAC hooked to MISO. New versions
 // have it hooked instead to MOSI, so we can use hardware SPI.
 //#define HW_SPI
 
-#ifdef OH300
+#if defined(OH300) && !defined(AD5791)
 // The OH300 variant uses the 18 bit AD5680 DAC instead of the AD5061.
 #define AD5680
 #endif
 
-#if defined(DEBUG)
+#ifdef MEASURE
+// The measurement frames take the place of the debug log.
+#undef DEBUG
+#define MEASURE_DAC DAC_MIDPOINT
+#endif
+
+#ifdef RAW_CAPTURE
+// So do the raw input frames.
+#undef DEBUG
+#endif
+
+#ifdef DEBUG
+// The debug log spells the events out already.
+#undef EVENT_LOG
+#endif
+
+#ifdef AUTO_F_CPU
+// The oscillator frequency is a variable, and F_CPU is only its initial guess.
+#define F_OSC f_osc
+// How many PPS intervals in a row have to agree on the frequency.
+#define OSC_DETECT_COUNT 3
+#else
+#define F_OSC F_CPU
+#endif
+
+#ifdef AUTO_BAUD
+// The baud rate is a variable, and BAUD is only its first guess.
+#define SERIAL_BAUD serial_baud
+#else
+#define SERIAL_BAUD BAUD
+#endif
+
+#if defined(DEBUG) || defined(MEASURE) || defined(RAW_CAPTURE) || defined(SURVEY) || defined(AIDING) || defined(EVENT_LOG)
 // define this to include the serial transmit infrastructure at all
 #define SERIAL_TX
 #endif
+#if defined(MEASURE) || defined(RAW_CAPTURE) || defined(EVENT_LOG)
+// and this for the binary frames
+#define TX_FRAMES
+#endif
+#if defined(DEBUG) || defined(MEASURE) || defined(RAW_CAPTURE) || defined(AIDING)
+// define this to keep track of the UTC second of each PPS.
+#define UTC_TAG
+#endif
 
 #if (defined(HW_SPI) && !defined(__AVR_ATmega328PB__))
 #error HW_SPI is only available with the ATMega328PB variant(s).
@@ -102,12 +233,15 @@
 // equal to nanoseconds, but it's close enough for us).
 //
 // The gain is how much we have to nudge the DAC to make 1 ns/sec
-// phase change-rate. That is, to alter the frequency by 1 ppb.
+// phase change-rate. That is, to alter the frequency by 1 ppb. It's given
+// here for a 16 bit DAC, and each bit more doubles it. For the OH300, that
+// makes 267 with the AD5680, and 1068 (or a ~1 ppt step) with the AD5791.
 #ifdef OH300
-#define GAIN 267
+#define GAIN_16 66.75
 #else
-#define GAIN 5
+#define GAIN_16 5
 #endif
+#define GAIN (GAIN_16 * (1L << (DAC_BITS - 16)))
 //
 // In the initial FLL mode, the calculus is different.
 // We expect F_CPU counts between each PPS interrupt.
@@ -130,11 +264,29 @@
 #define TC_SLOW 100
 #endif
 
-#ifdef AD5680
-#define DAC_RANGE (0x3ffffl)
+// The DAC drivers. Each one gives the part's resolution and how a value
+// goes into its 24 bit SPI frame, and if the part needs setting up before
+// it will put anything out, the frame that does that.
+#if defined(AD5791)
+// LDAC is tied low, so the output updates when CS goes back up.
+#define DAC_BITS 20
+// A write bit (0), a register address (1 is the DAC register), then the value.
+#define DAC_FRAME(value) (0x100000UL | (value))
+// The control register (address 2). It comes out of reset with the output
+// clamped to ground and tristated. Clear those (OPGND and DACTRI), and
+// set BIN/2sC for straight binary coding, leaving RBUF set as it was.
+#define DAC_INIT_FRAME (0x200000UL | _BV(4) | _BV(1))
+#elif defined(AD5680)
+#define DAC_BITS 18
+// The bottom two bits on the 5680A are "don't care".
+#define DAC_FRAME(value) ((value) << 2)
 #else
-#define DAC_RANGE (0xffff)
+// The AD5061. The top eight bits are zero (the bottom two of those are
+// shut-down bits, which we always leave 0).
+#define DAC_BITS 16
+#define DAC_FRAME(value) (value)
 #endif
+#define DAC_RANGE ((1L << DAC_BITS) - 1)
 #define DAC_MIDPOINT (DAC_RANGE >> 1)
 
 // The damping factor is how much we reduce the influence of the integral
@@ -142,6 +294,15 @@
 // (that is, the last time the FLL determined the starting DAC value).
 #define DAMPING 1.75
 
+#ifdef DRIFT_TERM
+// The drift term's damping. It needs to be at least four times DAMPING
+// for the loop to stay well damped (the two integrator zeros stay real).
+#define DRIFT_DAMPING (4 * DAMPING)
+// The drift term only integrates while the average phase error is within
+// this many ns, so that it doesn't wind up during transients.
+#define DRIFT_WINDOW 10.0
+#endif
+
 // our DAC has a positive slope - higher values mean higher frequencies.
 // If you have an inverse DAC slope, set this to -1.
 #define DAC_SIGN (1)
@@ -152,6 +313,61 @@
 // phase discriminator value.
 #define QE_COMPENSATION 1.5
 
+#ifdef HANGING_BRIDGE
+// When the receiver's sawtooth error lingers near a zero crossing - a
+// "hanging bridge" - QE barely changes from one second to the next, and
+// any error in our QE correction turns into a slow phase wander that the
+// loop would otherwise steer the oscillator after. Normally the average
+// second-to-second step in QE is comparable to the average size of QE
+// itself. When the step (averaged over HB_FILTER seconds) falls below
+// HB_RATIO of the size (averaged over HB_SCALE_FILTER seconds), we call it
+// a hanging bridge, until the step grows back past twice that ratio. In
+// the meantime, what's lost rounding the QE correction to whole ns is
+// carried into the next second, since it no longer averages out.
+#define HB_FILTER 16
+#define HB_SCALE_FILTER 256
+#define HB_RATIO 0.25
+#endif
+
+#ifdef SURVEY
+// The survey ends when it has gone on this many seconds, or when the
+// position's standard deviation gets down to this many meters.
+#define SURVEY_LENGTH 2000UL
+#define SURVEY_STDDEV 30UL
+// How often (in seconds) to repeat a command the receiver hasn't acted on.
+#define SURVEY_RETRY 10
+// Marks a position saved in EEPROM as valid.
+#define SURVEY_MAGIC 0x53555256UL
+// The SkyTraq timing modes, as reported in $PSTI,00.
+#define TIMING_PVT 0
+#define TIMING_SURVEY 1
+#define TIMING_STATIC 2
+// Our survey states. We start with either SURVEY_START or SURVEY_RESTORE,
+// depending on whether there's a saved position.
+#define SURVEY_START 0
+#define SURVEY_RUNNING 1
+#define SURVEY_QUERY 2
+#define SURVEY_RESTORE 3
+#define SURVEY_HOLD 4
+#endif
+
+#ifdef AIDING
+// Marks an aiding position saved in EEPROM as valid.
+#define AIDING_MAGIC 0x41494431UL
+// How long the receiver has to have been reporting a position before it's
+// saved (once per boot, and again if the power fails).
+#define AIDING_SAVE_DELAY 600
+// The SkyTraq restart (message 0x01) start modes. A hot start keeps whatever
+// the receiver still remembers, and adds our hints to it. There's no clock
+// to say how old the saved time is, so it's only sent when the power-fail
+// path saved it, and the reset that followed wasn't a power cycle. Any
+// other time, it's a warm start, which leaves the time to the receiver.
+#define AIDING_START_MODE 1
+#define AIDING_WARM_START_MODE 2
+// What nmea_to_centidegrees() returns for a coordinate it can't read.
+#define AIDING_BAD 0x7fff
+#endif
+
 #define LED_PORT PORTD
 #define LED0 _BV(PORTD2)
 #define LED1 _BV(PORTD3)
@@ -183,10 +399,155 @@
 // to land at this value.
 #define PHASE_ADC_MIDPOINT 512
 
+// The phase detector's range. When the phase drifts past one end, the reading
+// comes back in from the other.
+#define PHASE_WRAP 1000
+
+// PPS captures are handed from the capture ISR to the main loop through a
+// ring of this many samples (it must be a power of two), so that if the main
+// loop falls behind, samples queue up instead of being overwritten.
+#define PPS_QUEUE_LEN 4
+
+#ifdef DEBUG
+// Every received sentence is timestamped against the PPS it followed, and
+// the statistics for each sentence type are logged this often (in seconds).
+#define RX_TIMING_INTERVAL 60
+#endif
+
+// The sentence types we keep timing statistics on.
+#define RX_RMC 0
+#define RX_ZDA 1
+#define RX_PSTI 2
+#define RX_GSA 3
+#define RX_TYPES 4
+
 // Note that if you ever want to parse a longer sentence, be sure to bump this up.
 // But an ATTiny841 only has 1/2K of RAM, so...
 #define RX_BUF_LEN (96)
-#define TX_BUF_LEN (128)
+// A full debug record is around 200 characters, and the buffer has to hold
+// one without the transmitter falling behind.
+#define TX_BUF_LEN (256)
+
+#ifdef DEBUG
+// Logging verbosity. Events (lock and mode changes, RED, XXI/XXS and so on)
+// are always logged. At LOG_SUMMARY, the per-second record is only logged
+// every LOG_SUMMARY_INTERVAL seconds. At LOG_FULL, it's logged every second.
+#define LOG_EVENTS 0
+#define LOG_SUMMARY 1
+#define LOG_FULL 2
+#define LOG_SUMMARY_INTERVAL 10
+
+// If the transmit buffer is still more than half full when the next PPS
+// arrives, the serial link isn't keeping up, so we step the verbosity down.
+// After this many seconds in a row of starting with it empty, we step back up.
+#define LOG_UPSHIFT_SECONDS 30
+#endif
+
+#ifdef WARMUP
+// While the oven warms up, the oscillator frequency moves too quickly for the
+// FLL to chase. Instead, we measure it over WARMUP_WINDOW seconds at a time.
+// Once it moves by no more than WARMUP_DRIFT ppb from one window to the next
+// for WARMUP_STABLE windows in a row, we start the FLL. In the meantime, the
+// DAC is pre-positioned to where the drift says the frequency is heading.
+// If it never settles, we give up waiting after WARMUP_MAX_WINDOWS.
+#define WARMUP_WINDOW 60
+#define WARMUP_DRIFT 5.0
+#define WARMUP_STABLE 2
+#define WARMUP_MAX_WINDOWS 30
+#endif
+
+#ifdef STALL_TRACE
+// Marks the stall record as having been written by the watchdog interrupt.
+#define STALL_MAGIC 0x5354
+// Which ISR was running (if any). The watchdog interrupt can't run while
+// another ISR is running, so if one of them is stuck, this is all we get.
+#define STALL_ISR_NONE 0
+#define STALL_ISR_CAPT 1
+#define STALL_ISR_RX 2
+// Which part of the main loop we were last in.
+#define STAGE_IDLE 0 // waiting for a PPS
+#define STAGE_POWER 1 // checking the supply
+#define STAGE_RECORD 2 // starting on a PPS - the UTC, logging and survey
+#define STAGE_LOOP 3 // running the loop itself
+#endif
+
+#ifdef POWER_FAIL
+// The supply is measured against the 1.1 volt bandgap every
+// POWER_CHECK_TICKS Timer1 overflows (about 50 ms), but only well clear of
+// the PPS, since it means moving the ADC off of the phase detector. If it's
+// below POWER_FAIL_MV (comfortably above the 4.3 volt brownout), the state
+// is saved. Once that's happened, it has to come back above POWER_OK_MV
+// before it can happen again. Coming back to the 1.1 volt reference, the
+// cap on AREF has to discharge from AVCC, which takes REF_SETTLE_MS. A PPS
+// captured before then has a bad phase reading, so it's marked ADC_BORROWED
+// and skipped - that can only happen when there's no sign of the PPS.
+#define POWER_CHECK_TICKS 8
+#define REF_SETTLE_MS 20
+#define ADC_BORROWED 0xffff // not a possible 10 bit reading
+#define POWER_FAIL_MV 4600
+#define POWER_OK_MV 4700
+// Marks a saved checkpoint as valid.
+#define CHECKPOINT_MAGIC 0x43484b31UL
+#endif
+
+#ifdef PPS_FILTER
+// A PPS pulse shorter than this (in timer counts) is a glitch. The falling
+// edge is watched for while the capture ISR waits on the ADC (about 85 us),
+// so only pulses that end by then are measured - longer ones pass.
+#define PPS_MIN_WIDTH (F_OSC / 100000)
+// A PPS can't come sooner than a second, less this much (the same 100 ppm
+// the XXI check allows), after the last one.
+#define PPS_GUARD (F_OSC / 10000)
+#endif
+
+#ifdef AUTO_BAUD
+// Each baud rate is tried for BAUD_TRY_TICKS Timer1 overflows (about 2.5
+// seconds - long enough to be sure of a whole second's sentences), and
+// it's the one if BAUD_GOOD frames with good checksums arrive in that
+// time. Once it's found, going BAUD_LOST_TICKS (about 10 seconds) without
+// a good frame starts the search over. These are counted at F_CPU, which
+// is close enough for a timeout even with AUTO_F_CPU.
+#define BAUD_TRY_TICKS ((F_CPU / 65536) * 5 / 2)
+#define BAUD_LOST_TICKS ((F_CPU / 65536) * 10)
+#define BAUD_GOOD 2
+// Marks a baud rate saved in EEPROM as valid.
+#define BAUD_MAGIC 0x42415544UL
+// The protocols we recognize. Only NMEA has a parser, but a u-blox
+// receiver set to UBX only is worth calling out rather than just
+// searching forever. It's never taken as the baud rate, though.
+#define PROTO_NMEA 0
+#define PROTO_UBX 1
+#endif
+
+#ifdef JUMP_DETECT
+// In the slow mode, the phase rate (that is, the frequency error in ppb) is
+// measured over the last JUMP_WINDOW seconds, using the cycle count to follow
+// the phase detector across its wraps. It's compared to a baseline that's the
+// running average of the same measurement over JUMP_BASELINE seconds. If it
+// differs by more than JUMP_THRESHOLD ppb for JUMP_CONFIRM seconds in a row,
+// the oscillator has jumped. A step in the phase alone shows up in exactly
+// JUMP_WINDOW windows, so JUMP_CONFIRM has to be longer than that, and by
+// the time it's reached, the window starts after the jump began, so it
+// measures the new frequency. The difference is taken out of the trim value
+// all at once, and the loop runs with a time constant JUMP_BOOST times
+// shorter for JUMP_BOOST_SECONDS to take out the phase it ran off by.
+#define JUMP_WINDOW 8
+#define JUMP_BASELINE 256
+#define JUMP_THRESHOLD 2.0
+#define JUMP_CONFIRM (2 * JUMP_WINDOW)
+#define JUMP_BOOST 4
+#define JUMP_BOOST_SECONDS 600
+#endif
+
+#ifdef PHASE_DITHER
+// In the slow mode, the phase setpoint follows a triangle wave of
+// +/- DITHER_AMPLITUDE ns (ADC codes), moving one code every DITHER_STEP
+// seconds. That makes the period 4 * DITHER_AMPLITUDE * DITHER_STEP seconds
+// (a bit over an hour), which is slow enough for the loop to follow. The
+// setpoint is taken out of the phase error, and averages to zero.
+#define DITHER_AMPLITUDE 8
+#define DITHER_STEP 128
+#endif
 
 // The start mode watches the cycle count error over a 10 second window, and
 // adjusts the DAC until a minute goes by without any errors.
@@ -202,36 +563,278 @@
 #define MODE_SLOW 2
 #endif
 
+#ifdef DRIFT_TERM
+// The drift term only integrates in the long time constant modes.
+#ifdef MODE_MED
+#define DRIFT_MIN_MODE MODE_MED
+#else
+#define DRIFT_MIN_MODE MODE_SLOW
+#endif
+#endif
+
 unsigned long last_dac_value;
+#ifdef AUTO_F_CPU
+// The oscillator frequencies we know how to run with. They're far enough
+// apart that no PPS interval could be within 100 ppm of two of them.
+const unsigned long osc_freqs[] PROGMEM = { 5000000UL, 10000000UL, 12800000UL, 15000000UL, 20000000UL };
+unsigned long f_osc;
+unsigned char f_osc_known;
+unsigned long osc_candidate;
+unsigned char osc_matches;
+#endif
+#ifdef AUTO_BAUD
+// The baud rates to try, in order, after the saved one (if any).
+const unsigned long baud_rates[] PROGMEM = { 9600UL, 4800UL, 19200UL, 38400UL, 57600UL, 115200UL };
+struct baud_saved {
+  unsigned long magic;
+  unsigned long baud;
+};
+struct baud_saved EEMEM ee_baud;
+unsigned long serial_baud;
+unsigned char baud_index; // into baud_rates[], or 0xff for the saved one
+unsigned char baud_found;
+unsigned char baud_ubx_reported;
+unsigned int baud_timer; // timer_hibits at the start of this try, or the last good frame
+volatile unsigned char rx_nmea_good, rx_ubx_good; // since baud_timer
+#endif
 double iTerm;
+#ifdef DRIFT_TERM
+double dTerm;
+#endif
 double trim_value;
 double average_phase_error;
 double average_pps_error;
+#ifdef HANGING_BRIDGE
+double last_pps_err;
+double average_qe_step;
+double average_qe_size;
+double qe_remainder; // of the rounded QE correction, in ns
+unsigned char hanging_bridge;
+#endif
 unsigned char mode;
 unsigned char last_gps_locked;
 unsigned int exit_timer;
+#ifdef WARMUP
+unsigned char warming_up;
+unsigned char warmup_windows;
+unsigned char warmup_stable;
+unsigned int warmup_seconds;
+long warmup_cycles;
+double warmup_last_freq;
+#endif
+#ifdef JUMP_DETECT
+long jump_phase; // the unwrapped phase, in ns
+long jump_history[JUMP_WINDOW];
+unsigned char jump_index;
+unsigned char jump_filled;
+unsigned char jump_confirm;
+unsigned int jump_settle;
+int jump_last_phase;
+double jump_baseline;
+unsigned int jump_boost;
+#endif
+#ifdef PHASE_DITHER
+signed char dither_setpoint; // in ns
+signed char dither_direction;
+unsigned char dither_timer;
+#endif
 volatile unsigned int timer_hibits;
 volatile unsigned long pps_count;
 volatile unsigned char gps_locked;
 volatile unsigned char rx_buf[RX_BUF_LEN];
 volatile unsigned char rx_str_len;
-volatile unsigned int irq_adc_value;
-volatile unsigned long irq_time_span;
+// The capture ISR only ever writes into free slots, and the main loop only
+// frees a slot once it's done reading it. The one exception is the QE, which
+// the receive ISR adds after the fact to the sample for the PPS its sentence
+// followed, so the main loop copies samples out with interrupts off. The head
+// and tail are single bytes, so neither side ever sees a torn index from
+// the other. When the ring is full, new samples are dropped and counted.
+struct pps_sample {
+  unsigned long sequence; // the pps_count of this capture
+  unsigned long timestamp; // the extended Timer1 value at the capture
+  unsigned long span; // the timer counts since the previous (queued) capture
+  unsigned int adc; // the phase detector reading
+  unsigned char qe_ready; // set once the QE for this PPS arrives
+  char qe[8]; // the receiver's quantization error for this PPS
+#ifdef RAW_CAPTURE
+  // From the PPS to the '$' of the sentence the QE came in, and of this
+  // PPS's $GPGSA and $GPRMC, in timer counts. The last two are 0 until
+  // they come.
+  unsigned long qe_latency, gsa_latency, rmc_latency;
+#endif
+};
+volatile struct pps_sample pps_queue[PPS_QUEUE_LEN];
+volatile unsigned char pps_queue_head, pps_queue_tail;
+volatile unsigned int pps_overruns;
+#ifdef PPS_FILTER
+volatile unsigned int pps_glitches;
+#endif
+#ifdef POWER_FAIL
+// Set while read_vcc() has the ADC off of the phase detector.
+volatile unsigned char adc_borrowed;
+#endif
+// The extended Timer1 values of the last two PPS edges, and of the '$' and
+// terminator of the sentence being received. These are only used by ISRs.
+unsigned long pps_time, prev_pps_time;
+unsigned long rx_start_time, rx_end_time;
 #ifdef DEBUG
-volatile unsigned char pdop_buf[5];
-volatile unsigned char pps_err_buf[5];
+struct rx_timing {
+  unsigned int count;
+  unsigned long min, max, sum; // '$' arrival after the PPS, in timer counts
+  unsigned long length_sum; // '$' to terminator, in timer counts
+};
+volatile struct rx_timing rx_timing[RX_TYPES];
+const char rx_type_names[RX_TYPES][5] PROGMEM = { "RMC", "ZDA", "PSTI", "GSA" };
+#endif
+#ifdef UTC_TAG
 volatile unsigned char time_buf[7];
 volatile unsigned char date_buf[7];
+volatile unsigned char time_fresh;
+volatile unsigned long time_pps_count;
+unsigned long utc_second;
+#endif
+#ifdef DEBUG
+volatile unsigned char pdop_buf[5];
+unsigned char log_level;
+unsigned char log_quiet_seconds;
+#endif
+#ifdef SURVEY
+// The position is kept exactly as the receiver reports it in its timing
+// status message: latitude and longitude (64 bit doubles) and altitude
+// (a 32 bit float), all big-endian. We never need to do math on it.
+struct survey_position {
+  unsigned long magic;
+  unsigned char position[20];
+};
+struct survey_position EEMEM ee_survey_position;
+struct survey_position survey_saved;
+unsigned char survey_state;
+unsigned char survey_timer;
+unsigned int survey_seconds;
+volatile unsigned char receiver_timing_mode;
+volatile unsigned char survey_reply[20];
+volatile unsigned char survey_reply_ready;
+unsigned char rx_binary;
+#endif
+#ifdef AIDING
+// A position in the units of the SkyTraq restart message: hundredths of
+// a degree (negative is south or west) and meters, and the UTC second it
+// was saved at.
+struct aiding {
+  unsigned long magic;
+  unsigned long utc;
+  int lat, lon, alt;
+  unsigned char power_fail; // saved as the power failed, and not since it came back
+};
+struct aiding EEMEM ee_aiding;
+struct aiding aiding_saved; // from EEPROM, for the restart
+struct aiding aiding_now; // from the receiver, to be saved
+unsigned char aiding_pending;
+unsigned char aiding_time_ok; // the saved time is fresh enough to send
+unsigned int aiding_fix_seconds;
+volatile unsigned char receiver_heard;
+volatile unsigned char pos_buf[32]; // lat,N,lon,W from $GPRMC
+volatile unsigned char alt_buf[8]; // from $GPGGA
+volatile unsigned char pos_fresh;
+#endif
+#ifdef STALL_TRACE
+// These are in .noinit, so a watchdog reset leaves them alone.
+unsigned int stall_magic __attribute__((section(".noinit")));
+unsigned int stall_pc __attribute__((section(".noinit")));
+volatile unsigned char stall_isr __attribute__((section(".noinit")));
+volatile unsigned char stall_stage __attribute__((section(".noinit")));
+#endif
+#ifdef POWER_FAIL
+// The loop's state, as of the last time the power started to fail.
+struct checkpoint {
+  unsigned long magic;
+  double trim_value;
+  double iTerm;
+  double dTerm; // 0 without DRIFT_TERM
+  unsigned char mode;
+  uint16_t crc; // CRC-16 of everything above
+};
+struct checkpoint EEMEM ee_checkpoint;
+unsigned char power_failing;
+unsigned int last_power_check;
+#ifdef WARMUP
+// The frequency error (with the DAC at midpoint) the checkpoint was
+// holding, if one was restored.
+unsigned char warmup_ckpt;
+double warmup_ckpt_freq;
+#endif
 #endif
 #ifdef SERIAL_TX
 // serial transmit buffer setup
 volatile char txbuf[TX_BUF_LEN];
 volatile unsigned int txbuf_head, txbuf_tail;
+unsigned int tx_dropped;
+#endif
+
+#ifdef EVENT_LOG
+// The event IDs are shared with GPSDO_FE.c.
+#include "GPSDO_events.h"
+#endif
+
+#ifdef MEASURE
+// 'M' - sent for every PPS. The types here and in 'F' are fixed-size, and
+// they're packed, so that the simulator's host build sends the same layout.
+struct measure_sample {
+  uint32_t pps; // the PPS count
+  uint32_t utc; // the UTC second of the PPS, or 0 if not yet known
+  int32_t phase; // the oscillator's phase against GPS, in 0.1 ns. Wraps modulo 2^32.
+  int32_t cycles; // the cycle count error since the last M frame
+  uint16_t adc; // the raw phase detector reading
+  int16_t qe; // the receiver's quantization error, in 0.1 ns
+  uint8_t seconds; // how many seconds since the last M frame (more than 1 if PPS were missed or skipped), 0 if the measurement (re)started
+} __attribute__((packed));
+
+// 'F' - sent at the end of each gate interval.
+struct measure_freq {
+  uint32_t utc; // the UTC second at the end of the gate, or 0 if not known
+  uint16_t gate; // the gate length in seconds
+  int32_t freq; // the average fractional frequency offset over the gate, in parts per 10^12
+} __attribute__((packed));
+
+// The gate lengths, in seconds.
+const unsigned int measure_gates[] PROGMEM = { 1, 10, 100, 1000 };
+#define MEASURE_GATE_COUNT (sizeof(measure_gates) / sizeof(measure_gates[0]))
+// A gap longer than this between M frames won't fit in one, so the
+// measurement starts over. It's also short enough for the timer to measure
+// by itself (it wraps after 429 seconds) when the UTC isn't known.
+#define MEASURE_MAX_GAP 255
+
+unsigned char measure_started;
+long measure_wraps;
+double measure_last_phase;
+unsigned long measure_last_utc, measure_last_timestamp;
+long measure_gate_start[MEASURE_GATE_COUNT];
+unsigned int measure_gate_time[MEASURE_GATE_COUNT];
+#endif
+
+#ifdef RAW_CAPTURE
+// 'R' - sent for every PPS, with everything the loop takes from it. The
+// types are fixed-size so that the simulator's host build of the firmware
+// sends the same layout.
+struct raw_sample {
+  uint32_t pps; // the PPS count
+  uint32_t utc; // the UTC second of the PPS, or 0 if not yet known
+  uint32_t timestamp; // the extended Timer1 value at the capture
+  uint32_t span; // the timer counts since the previous capture
+  uint32_t qe_latency; // from the PPS to the '$' of its $PSTI, in timer counts (0 if no QE)
+  uint32_t gsa_latency; // the same for its $GPGSA (0 if it hadn't come when the loop took the PPS)
+  uint32_t rmc_latency; // and its $GPRMC
+  uint16_t adc; // the raw phase detector reading
+  char qe[7]; // the QE, as the receiver sent it (null terminated if shorter)
+  uint8_t flags;
+};
+// The flags.
+#define RAW_LOCKED 1 // the receiver had a fix
+#define RAW_QE 2 // the QE came for this PPS
 #endif
 
-// For the 5680, the data format is 4 bits of 0, 18 bits of big-endian data, and two bits of 0.
-// For the 5061, the data format is 8 bits of 0 (the bottom two are shut-down bits that we always
-// set to 0), then 16 bits of big-endian data.
+// All of the DACs take a 24 bit frame, big-endian. See DAC_FRAME() above
+// for where the value goes in it.
 
 // Data is clocked on the falling
 // edge of the clock pin, and CS must be held low the
@@ -240,20 +843,7 @@ volatile unsigned int txbuf_head, txbuf_tail;
 // is way faster than our clock speed, so we don't need
 // to perform any delays.
 
-static void writeDacValue(unsigned long value) {
-  // Limit the value to the actual range of the DAC
-  value &= DAC_RANGE;
-
-  if (value == last_dac_value) return; // don't do useless writes - results in a glitch for no reason
-  last_dac_value = value;
-
-#ifdef AD5680
-  // The bottom two bits on the 5680A are "don't care". The actual data
-  // starts at bit 3.
-  value <<= 2;
-#endif
-  // This is the point where we'd OR in any control bits, but there are none we want.
-
+static void dac_send(const unsigned long value) {
 #ifdef HW_SPI
   // Now we start - Assert !CS
   DAC_PORT &= ~DAC_CS;
@@ -284,6 +874,16 @@ static void writeDacValue(unsigned long value) {
   DAC_PORT |= DAC_CS;
 }
 
+static void writeDacValue(unsigned long value) {
+  // Limit the value to the actual range of the DAC
+  value &= DAC_RANGE;
+
+  if (value == last_dac_value) return; // don't do useless writes - results in a glitch for no reason
+  last_dac_value = value;
+
+  dac_send(DAC_FRAME(value));
+}
+
 // Timer 1's TCNT register is the low bits. They're ORed
 // onto this to make an unsigned long. That gives us more
 // than 400 seconds between full overflows (at 10 MHz).
@@ -297,6 +897,9 @@ ISR(TIMER1_OVF_vect) {
 // value just so the main loop will know that it happened.
 ISR(TIMER1_CAPT_vect) {
   static unsigned long last_timer_val;
+#ifdef STALL_TRACE
+  stall_isr = STALL_ISR_CAPT;
+#endif
 
   // every once in a while, the input capture and timer overflow
   // collide. The input capture interrupt has priority, so when this
@@ -316,35 +919,244 @@ ISR(TIMER1_CAPT_vect) {
 
   unsigned long timer_val = (((unsigned long)local_timer_hibits) << 16) | captured_lowbits;
 
+#ifdef PPS_FILTER
+  if (!(TCCR1B & _BV(ICES1))) {
+    // This is the end of a pulse too long to have been measured (so
+    // it passed). Go back to waiting for the next one.
+    TCCR1B |= _BV(ICES1);
+    TIFR1 = _BV(ICF1); // changing the edge can set the flag
+#ifdef STALL_TRACE
+    stall_isr = STALL_ISR_NONE;
+#endif
+    return;
+  }
+  // Catch the falling edge, if it comes while the ADC is busy.
+  TCCR1B &= ~_BV(ICES1);
+  TIFR1 = _BV(ICF1);
+#endif
+
   // start ADC operation
   ADCSRA |= _BV(ADSC);
   // wait for ADC to finish
   while(ADCSRA & _BV(ADSC)) ; // don't pet the watchdog - this should never take that long.
   unsigned int adc_value = ADC;
+#ifdef POWER_FAIL
+  if (adc_borrowed) adc_value = ADC_BORROWED;
+#endif
 
-  irq_adc_value = adc_value;
+#ifdef PPS_FILTER
+  {
+    unsigned char glitch = 0;
+    if (TIFR1 & _BV(ICF1)) {
+      // The pulse has already ended. It can't have been long enough to
+      // wrap the 16 bit difference.
+      if ((unsigned int)(ICR1 - captured_lowbits) < PPS_MIN_WIDTH) glitch = 1;
+      TCCR1B |= _BV(ICES1);
+      TIFR1 = _BV(ICF1);
+    }
+#ifdef AUTO_F_CPU
+    // Until we know the oscillator, we don't know how long a second is.
+    if (f_osc_known)
+#endif
+    if (pps_count != 0 && timer_val - last_timer_val < F_OSC - PPS_GUARD) glitch = 1;
+    if (glitch) {
+      // Leave last_timer_val alone, so the next PPS is measured from the
+      // last real one.
+      pps_glitches++;
+#ifdef STALL_TRACE
+      stall_isr = STALL_ISR_NONE;
+#endif
+      return;
+    }
+  }
+#endif
 
-  irq_time_span = timer_val - last_timer_val;
-  last_timer_val = timer_val;
+  pps_count++;
+  prev_pps_time = pps_time;
+  pps_time = timer_val;
+
+  unsigned char next = (pps_queue_head + 1) & (PPS_QUEUE_LEN - 1);
+  if (next == pps_queue_tail) {
+    // The main loop is too far behind. Drop this one, but leave last_timer_val
+    // alone so the next sample's span covers it (it'll show up as XXS).
+    pps_overruns++;
+#ifdef STALL_TRACE
+    stall_isr = STALL_ISR_NONE;
+#endif
+    return;
+  }
+  volatile struct pps_sample *sample = &(pps_queue[pps_queue_head]);
+  sample->sequence = pps_count;
+  sample->timestamp = timer_val;
+  sample->span = timer_val - last_timer_val;
+  sample->adc = adc_value;
+  sample->qe_ready = 0; // The *next* sawtooth msg applies to *this* pps.
+#ifdef RAW_CAPTURE
+  sample->gsa_latency = 0;
+  sample->rmc_latency = 0;
+#endif
+  pps_queue_head = next;
 
-  pps_err_buf[0] = 0; // The *next* sawtooth msg applies to *this* pps.
+  last_timer_val = timer_val;
 
-  pps_count++;
+#ifdef STALL_TRACE
+  stall_isr = STALL_ISR_NONE;
+#endif
+}
 
+#ifdef STALL_TRACE
+// The first watchdog timeout lands here instead of resetting. Record the
+// address we interrupted, then wait for the second timeout to reset us.
+// Since we never return, there's no need to save any registers, and so
+// the return address is right on top of the stack.
+ISR(WDT_vect, ISR_NAKED) {
+  asm volatile("clr __zero_reg__"); // a naked ISR has no prologue to do this for it
+  unsigned char *sp = (unsigned char *)SP;
+  stall_pc = ((sp[1] << 8) | sp[2]) << 1; // it's a word address, high byte first
+  stall_magic = STALL_MAGIC;
+  while(1) ;
 }
+#endif
 
 static inline void handleGPS();
 
-#ifdef __AVR_ATmega328PB__
-ISR(USART0_RX_vect) {
-#else
-ISR(USART_RX_vect) {
+#if defined(AUTO_F_CPU) || defined(AUTO_BAUD)
+// Set the baud rate divisor for the given oscillator frequency. We always
+// use double speed mode, since it's the more accurate of the two.
+static void set_baud(const unsigned long f) {
+  unsigned int ubrr = (f + 4UL * SERIAL_BAUD) / (8UL * SERIAL_BAUD) - 1;
+  UBRR0H = ubrr >> 8;
+  UBRR0L = ubrr & 0xff;
+  UCSR0A = _BV(U2X);
+}
+#endif
+
+#ifdef AUTO_F_CPU
+
+// Which of osc_freqs[] is this PPS interval (in timer counts) within
+// 100 ppm of? Returns 0 if none of them.
+static unsigned long osc_match(const unsigned long span) {
+  for(int i = 0; i < sizeof(osc_freqs) / sizeof(osc_freqs[0]); i++) {
+    unsigned long f = pgm_read_dword(&(osc_freqs[i]));
+    if (labs((long)(span - f)) <= f / 10000) return f;
+  }
+  return 0;
+}
+#endif
+#ifdef SURVEY
+static inline void handleBinary();
+#endif
+
+// The current extended Timer1 value. This is only for use with interrupts
+// off, and does the same overflow fix-up as the capture ISR.
+static inline unsigned long timer_now() {
+  unsigned int lowbits = TCNT1;
+  unsigned int hibits = timer_hibits;
+  if ((TIFR1 & _BV(TOV1)) && (lowbits < 0x8000)) hibits++;
+  return (((unsigned long)hibits) << 16) | lowbits;
+}
+
+// Whether a sentence that started before the latest PPS is still coming
+// in, and so belongs to the PPS before it - the one with this sequence
+// number. If it's a $PSTI, that sample's QE is in it. A sentence that
+// hasn't ended a second after its '$' never will.
+static unsigned char straddle_pending(unsigned long sequence) {
+  unsigned char pending;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    pending = rx_str_len != 0 && sequence == pps_count - 1
+#ifdef SURVEY
+      && !rx_binary
+#endif
+      && ((long)(pps_time - rx_start_time)) > 0 && (timer_now() - rx_start_time) < F_OSC;
+  }
+  return pending;
+}
+
+#ifdef AUTO_BAUD
+// Just enough of a UBX parser to recognize a u-blox receiver that's been
+// set to binary output. A frame is B5 62, a class and ID, a little-endian
+// payload length, the payload, then a two byte Fletcher checksum of
+// everything after the sync bytes. None of it is kept.
+static inline void scan_ubx(const unsigned char rx_char) {
+  static unsigned char state = 0, ck_a, ck_b;
+  static unsigned int len, count;
+  switch(state) {
+    case 0:
+      if (rx_char == 0xb5) state++;
+      return;
+    case 1:
+      state = (rx_char == 0x62) ? 2 : 0;
+      ck_a = ck_b = 0;
+      return;
+    case 7:
+      state = (rx_char == ck_a) ? 8 : 0;
+      return;
+    case 8:
+      if (rx_char == ck_b && rx_ubx_good < 0xff) rx_ubx_good++;
+      state = 0;
+      return;
+  }
+  ck_a += rx_char;
+  ck_b += ck_a;
+  switch(state) {
+    case 4:
+      len = rx_char;
+      break;
+    case 5:
+      len |= rx_char << 8;
+      count = 0;
+      if (len > RX_BUF_LEN) {
+        state = 0; // too long to be believed
+        return;
+      }
+      if (len == 0) {
+        state = 7;
+        return;
+      }
+      break;
+    case 6:
+      if (++count < len) return;
+      break;
+  }
+  state++;
+}
+#endif
+
+static inline void handle_rx(const unsigned char rx_char) {
+#ifdef AUTO_BAUD
+  scan_ubx(rx_char);
+#endif
+#ifdef SURVEY
+  // SkyTraq binary messages are A0 A1, a two byte payload length,
+  // the payload, an XOR checksum of the payload, then CR LF.
+  if (rx_str_len == 0 && rx_char == 0xa0) rx_binary = 1;
+  if (rx_binary) {
+    rx_buf[rx_str_len++] = rx_char;
+    if (rx_str_len == 2 && rx_char != 0xa1) {
+      rx_binary = 0; // not a binary message after all
+      rx_str_len = 0;
+    } else if (rx_str_len >= 4) {
+      unsigned int frame_len = ((rx_buf[2] << 8) | rx_buf[3]) + 7;
+      if (frame_len > RX_BUF_LEN) {
+        // It's too long. Start over.
+        rx_binary = 0;
+        rx_str_len = 0;
+      } else if (rx_str_len == frame_len) {
+        handleBinary();
+        rx_binary = 0;
+        rx_str_len = 0;
+      }
+    }
+    return;
+  }
 #endif
-  unsigned char rx_char = UDR0;
-  
-  if (rx_str_len == 0 && rx_char != '$') return; // wait for a "$" to start the line.
+  if (rx_str_len == 0) {
+    if (rx_char != '$') return; // wait for a "$" to start the line.
+    rx_start_time = timer_now();
+  }
   rx_buf[rx_str_len] = rx_char;
   if (rx_char == 0x0d || rx_char == 0x0a) {
+    rx_end_time = timer_now();
     rx_buf[rx_str_len] = 0; // null terminate
     handleGPS();
     rx_str_len = 0; // now clear the buffer
@@ -356,6 +1168,20 @@ ISR(USART_RX_vect) {
   }
 }
 
+#ifdef __AVR_ATmega328PB__
+ISR(USART0_RX_vect) {
+#else
+ISR(USART_RX_vect) {
+#endif
+#ifdef STALL_TRACE
+  stall_isr = STALL_ISR_RX;
+#endif
+  handle_rx(UDR0);
+#ifdef STALL_TRACE
+  stall_isr = STALL_ISR_NONE;
+#endif
+}
+
 const char hexes[] PROGMEM = "0123456789abcdef";
 
 static inline unsigned char charHex(unsigned char h) {
@@ -385,19 +1211,24 @@ ISR(USART_UDRE_vect) {
   if (++txbuf_tail == TX_BUF_LEN) txbuf_tail = 0; // point to the next char
 }
 
+static inline unsigned int tx_buf_in_use() {
+  int buf_in_use;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    buf_in_use = txbuf_head - txbuf_tail;
+  }
+  if (buf_in_use < 0) buf_in_use += TX_BUF_LEN;
+  return buf_in_use;
+}
+
 // Note that we're only really going to use the transmit side
 // either for diagnostics, or during setup to configure the
-// GPS receiver. If the TX buffer fills up, then this method
-// will block, which should be avoided.
+// GPS receiver. If the TX buffer fills up, then the character
+// is dropped (and counted) rather than stalling the loop.
 static inline void tx_char(const char c) {
-  int buf_in_use;
-  do {
-    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-      buf_in_use = txbuf_head - txbuf_tail;
-    }
-    if (buf_in_use < 0) buf_in_use += TX_BUF_LEN;
-    wdt_reset(); // we might be waiting a while.
-  } while (buf_in_use >= TX_BUF_LEN - 2) ; // wait for room in the transmit buffer
+  if (tx_buf_in_use() >= TX_BUF_LEN - 2) {
+    tx_dropped++;
+    return;
+  }
 
   txbuf[txbuf_head] = c;
   ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
@@ -418,6 +1249,83 @@ static inline void tx_str(const char *buf) {
     tx_char(buf[i]);
 }
 
+#if defined(SURVEY) || defined(AIDING)
+// Send a SkyTraq binary message. If there isn't room in the transmit buffer
+// for all of it, nothing is sent and we'll try again later.
+static unsigned char skytraq_send(const unsigned char *payload, const unsigned char len) {
+  if (tx_buf_in_use() + len + 7 >= TX_BUF_LEN - 2) return 0;
+  unsigned char checksum = 0;
+  tx_char(0xa0);
+  tx_char(0xa1);
+  tx_char(0);
+  tx_char(len);
+  for(int i = 0; i < len; i++) {
+    tx_char(payload[i]);
+    checksum ^= payload[i];
+  }
+  tx_char(checksum);
+  tx_char(0x0d);
+  tx_char(0x0a);
+  return 1;
+}
+#endif
+
+#ifdef SURVEY
+// Message 0x54 - configure the timing mode. The position only matters
+// for static mode.
+static unsigned char survey_configure(const unsigned char timing_mode, const unsigned char *position) {
+  unsigned char msg[31];
+  memset(msg, 0, sizeof(msg));
+  msg[0] = 0x54;
+  msg[1] = timing_mode;
+  for(int i = 0; i < 4; i++) {
+    msg[2 + i] = (unsigned char)(SURVEY_LENGTH >> (24 - 8 * i));
+    msg[6 + i] = (unsigned char)(SURVEY_STDDEV >> (24 - 8 * i));
+  }
+  if (position != NULL) memcpy(msg + 10, position, 20);
+  msg[30] = 0; // update SRAM only - the position lives in our EEPROM.
+  return skytraq_send(msg, sizeof(msg));
+}
+#endif
+
+#ifdef TX_FRAMES
+// Binary frames are a sync byte, a type byte, a payload length byte, the
+// payload, then the CRC-CCITT (initial value 0xffff) of the type, length
+// and payload bytes, low byte first. Payloads are the structs below, as the
+// AVR lays them out: packed, little-endian, with 16 bit ints.
+#define FRAME_SYNC 0xa5
+
+static void tx_frame(const unsigned char type, const void *payload, const unsigned char len) {
+  uint16_t crc = 0xffff;
+  tx_char(FRAME_SYNC);
+  tx_char(type);
+  crc = _crc_ccitt_update(crc, type);
+  tx_char(len);
+  crc = _crc_ccitt_update(crc, len);
+  for(int i = 0; i < len; i++) {
+    unsigned char c = ((const unsigned char *)payload)[i];
+    tx_char(c);
+    crc = _crc_ccitt_update(crc, c);
+  }
+  tx_char(crc & 0xff);
+  tx_char(crc >> 8);
+}
+
+#ifdef EVENT_LOG
+static void log_event(const unsigned char id, const long a, const long b, const long c) {
+  struct event_frame frame;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    frame.pps = pps_count;
+  }
+  frame.id = id;
+  frame.args[0] = a;
+  frame.args[1] = b;
+  frame.args[2] = c;
+  tx_frame('E', &frame, offsetof(struct event_frame, args) + sizeof(frame.args[0]) * pgm_read_byte(&(event_args[id])));
+}
+#endif
+#endif
+
 #endif
 
 // A repeated strchr, effectively.
@@ -430,6 +1338,31 @@ static char* skip_commas(char *ptr, int num) {
   return ptr;
 }
 
+#ifdef DEBUG
+static void rx_timing_add(const unsigned char type, const unsigned long latency) {
+  volatile struct rx_timing *t = &(rx_timing[type]);
+  if (t->count == 0 || latency < t->min) t->min = latency;
+  if (t->count == 0 || latency > t->max) t->max = latency;
+  t->sum += latency;
+  t->length_sum += rx_end_time - rx_start_time;
+  t->count++;
+}
+#endif
+
+// The queued sample for the PPS a sentence followed, or NULL if the main
+// loop has already taken it (or it was dropped).
+static inline volatile struct pps_sample *sentence_sample(const unsigned char straddled, const unsigned long sequence) {
+  if (pps_queue_head == pps_queue_tail) return NULL; // the latest PPS has already been handled
+  unsigned char slot = (pps_queue_head - 1) & (PPS_QUEUE_LEN - 1);
+  if (straddled) {
+    if (slot == pps_queue_tail) return NULL; // the one before has already been handled
+    slot = (slot - 1) & (PPS_QUEUE_LEN - 1);
+  }
+  volatile struct pps_sample *sample = &(pps_queue[slot]);
+  if (sample->sequence != sequence) return NULL; // that PPS was dropped
+  return sample;
+}
+
 // When this method is called, we've just received
 // a complete NEMA GPS sentence.
 static inline void handleGPS() {
@@ -451,34 +1384,126 @@ static inline void handleGPS() {
   if (sent_checksum != checksum) {
     return; // bad checksum.
   }
+#ifdef AUTO_BAUD
+  if (rx_nmea_good < 0xff) rx_nmea_good++;
+#endif
+
+  // A sentence describes the PPS that preceded its '$'. If another PPS
+  // arrived while it was coming in, it still belongs to the one before.
+  unsigned char straddled = ((long)(pps_time - rx_start_time)) > 0;
+  unsigned long sentence_pps_count = pps_count - straddled;
+  // How long after that PPS the sentence started. Sentences more than a
+  // second after it are from a receiver that isn't putting out a PPS.
+  unsigned long latency = rx_start_time - (straddled ? prev_pps_time : pps_time);
+  unsigned char timely = (sentence_pps_count != 0 && latency < F_OSC);
  
   char *ptr = (char *)rx_buf;
   if (!strncmp_P((const char*)rx_buf, PSTR("$GPRMC"), 6)) {
     // $GPRMC,172313.000,A,xxxx.xxxx,N,xxxxx.xxxx,W,0.01,180.80,260516,,,D*74\x0d\x0a
-#ifdef DEBUG
+#ifdef UTC_TAG
     ptr = skip_commas(ptr, 1);
     if (ptr == NULL) return; // not enough commas
     strncpy((char *)time_buf, ptr, 6);
     time_buf[sizeof(time_buf) - 1] = 0;
-    ptr = skip_commas(ptr, 8);
+    ptr = skip_commas(ptr, 1);
+    if (ptr == NULL) return; // not enough commas
+    unsigned char valid = (*ptr == 'A');
+#ifdef AIDING
+    if (valid) {
+      // Keep the position fields (lat,N,lon,W) as text. The main loop
+      // turns them into numbers.
+      char *pos = skip_commas(ptr, 1), *pos_end = skip_commas(ptr, 5);
+      if (pos_end == NULL) return; // not enough commas
+      unsigned char len = (pos_end - 1) - pos;
+      if (len > sizeof(pos_buf) - 1) len = sizeof(pos_buf) - 1; // truncate if too long
+      memcpy((void*)pos_buf, pos, len);
+      pos_buf[len] = 0; // null terminate
+      pos_fresh = 1;
+    }
+#endif
+    ptr = skip_commas(ptr, 7);
     if (ptr == NULL) return; // not enough commas
     strncpy((char *)date_buf, ptr, 6);
     date_buf[sizeof(date_buf) - 1] = 0;
+    if (valid) {
+      // The time in this sentence belongs to the PPS that preceded it.
+      time_pps_count = sentence_pps_count;
+      time_fresh = 1;
+    }
+#endif
+#ifdef DEBUG
+    if (timely) rx_timing_add(RX_RMC, latency);
+#endif
+#ifdef RAW_CAPTURE
+    if (timely) {
+      volatile struct pps_sample *sample = sentence_sample(straddled, sentence_pps_count);
+      if (sample != NULL) sample->rmc_latency = latency;
+    }
+#endif
+#ifdef UTC_TAG
+  } else if (!strncmp_P((const char*)rx_buf, PSTR("$GPZDA"), 6)) {
+    // $GPZDA,172313.000,26,05,2016,00,00*5B
+    ptr = skip_commas(ptr, 1);
+    if (ptr == NULL || *ptr == ',') return; // not enough commas, or no time yet
+    strncpy((char *)time_buf, ptr, 6);
+    time_buf[sizeof(time_buf) - 1] = 0;
+    // Rearrange the day, month and year fields into RMC's ddmmyy form.
+    for(int j = 0; j < 3; j++) {
+      ptr = skip_commas(ptr, 1);
+      if (ptr == NULL) return; // not enough commas
+      if (j == 2) ptr += 2; // only the last two digits of the year
+      date_buf[j * 2] = ptr[0];
+      date_buf[j * 2 + 1] = ptr[1];
+    }
+    date_buf[sizeof(date_buf) - 1] = 0;
+    time_pps_count = sentence_pps_count;
+    time_fresh = 1;
+#ifdef DEBUG
+    if (timely) rx_timing_add(RX_ZDA, latency);
+#endif
 #endif
   } else if (!strncmp_P((const char*)rx_buf, PSTR("$PSTI,00"), 8)) {
     // $PSTI,00,2,0,5.8,,*3F
+#ifdef DEBUG
+    if (timely) rx_timing_add(RX_PSTI, latency);
+#endif
+#ifdef SURVEY
+    {
+      char *mode_ptr = skip_commas(ptr, 2);
+      if (mode_ptr != NULL && *mode_ptr >= '0' && *mode_ptr <= '2') receiver_timing_mode = *mode_ptr - '0';
+    }
+#endif
+    if (!timely) return; // there's no PPS for this QE to go with
     ptr = skip_commas(ptr, 4);
     if (ptr == NULL) return; // not enough commas
+    // Find the sample for the PPS this sentence followed.
+    volatile struct pps_sample *sample = sentence_sample(straddled, sentence_pps_count);
+    if (sample == NULL) return;
+    if (sample->qe_ready) return; // we already have one for this PPS
     unsigned char len = (strchr((const char *)ptr, ',')) - ptr;
-    if (len > sizeof(pdop_buf) - 1) len = sizeof(pdop_buf) - 1; // truncate if too long
-    memcpy((void*)pps_err_buf, ptr, len);
-    pps_err_buf[len] = 0; // null terminate
+    if (len > sizeof(sample->qe) - 1) len = sizeof(sample->qe) - 1; // truncate if too long
+    memcpy((void*)sample->qe, ptr, len);
+    sample->qe[len] = 0; // null terminate
+#ifdef RAW_CAPTURE
+    sample->qe_latency = latency;
+#endif
+    sample->qe_ready = 1;
   } else if (!strncmp_P((const char*)rx_buf, PSTR("$GPGSA"), 6)) {
     // $GPGSA,A,3,02,06,12,24,25,29,,,,,,,1.61,1.33,0.90*01
     ptr = skip_commas(ptr, 2);
     if (ptr == NULL) return; // not enough commas
     gps_locked = (*ptr == '3' || *ptr == '2');
+#ifdef AIDING
+    receiver_heard = 1;
+#endif
+#ifdef RAW_CAPTURE
+    if (timely) {
+      volatile struct pps_sample *sample = sentence_sample(straddled, sentence_pps_count);
+      if (sample != NULL) sample->gsa_latency = latency;
+    }
+#endif
 #ifdef DEBUG
+    if (timely) rx_timing_add(RX_GSA, latency);
     // continue parsing to find the PDOP value
     ptr = skip_commas(ptr, 13);
     if (ptr == NULL) return; // not enough commas
@@ -487,8 +1512,132 @@ static inline void handleGPS() {
     memcpy((void*)pdop_buf, ptr, len);
     pdop_buf[len] = 0; // null terminate
 #endif
+#ifdef AIDING
+  } else if (!strncmp_P((const char*)rx_buf, PSTR("$GPGGA"), 6)) {
+    // $GPGGA,172313.000,xxxx.xxxx,N,xxxxx.xxxx,W,2,09,0.90,42.7,M,-25.6,M,,0000*5C
+    ptr = skip_commas(ptr, 9);
+    if (ptr == NULL || *ptr == ',') return; // not enough commas, or no fix
+    unsigned char len = (strchr((const char *)ptr, ',')) - ptr;
+    if (len > sizeof(alt_buf) - 1) len = sizeof(alt_buf) - 1; // truncate if too long
+    memcpy((void*)alt_buf, ptr, len);
+    alt_buf[len] = 0; // null terminate
+#endif
+  }
+}
+
+#ifdef SURVEY
+// When this method is called, we've just received a complete
+// SkyTraq binary message.
+static inline void handleBinary() {
+  unsigned int len = (rx_buf[2] << 8) | rx_buf[3];
+  unsigned char checksum = 0;
+  for(int i = 0; i < len; i++) checksum ^= rx_buf[4 + i];
+  if (checksum != rx_buf[4 + len]) return; // bad checksum.
+
+  // 0xC2 is the reply to a timing mode query. The saved position is
+  // at offset 10 of the payload.
+  if (rx_buf[4] == 0xc2 && len >= 30) {
+    memcpy((void*)survey_reply, (const void*)(rx_buf + 4 + 10), sizeof(survey_reply));
+    survey_reply_ready = 1;
+  }
+}
+#endif
+
+#ifdef UTC_TAG
+// Days in the year before the first of each month (non-leap years).
+const unsigned int month_days[] PROGMEM = { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334 };
+
+static unsigned char two_digits(const char *ptr) {
+  if (ptr[0] < '0' || ptr[0] > '9' || ptr[1] < '0' || ptr[1] > '9') return 0xff;
+  return (ptr[0] - '0') * 10 + (ptr[1] - '0');
+}
+
+// Turn an NMEA ddmmyy date and hhmmss time into seconds since the
+// Unix epoch. Two digit years are 20xx. Returns 0 if either is malformed.
+static unsigned long nmea_to_utc(const char *date, const char *time) {
+  unsigned char day = two_digits(date), month = two_digits(date + 2), year = two_digits(date + 4);
+  unsigned char hour = two_digits(time), min = two_digits(time + 2), sec = two_digits(time + 4);
+  if (day == 0 || day > 31 || month == 0 || month > 12 || year > 99) return 0;
+  if (hour > 23 || min > 59 || sec > 60) return 0;
+  // 2000 was a leap year, so (year + 3) / 4 is the count of leap days before this year.
+  unsigned int days = 365U * year + (year + 3) / 4 + pgm_read_word(&(month_days[month - 1])) + day - 1;
+  if ((year & 3) == 0 && month > 2) days++; // we're past this year's leap day
+  return 946684800UL + days * 86400UL + hour * 3600UL + min * 60U + sec;
+}
+#endif
+
+#ifdef AIDING
+// Turn an NMEA (d)ddmm.mmmm coordinate and the hemisphere field after it
+// into hundredths of a degree. Returns AIDING_BAD if either is malformed.
+static int nmea_to_centidegrees(const char *ptr) {
+  unsigned long whole = 0, frac = 0;
+  unsigned char digits = 0;
+  if (*ptr < '0' || *ptr > '9') return AIDING_BAD;
+  while(*ptr >= '0' && *ptr <= '9') whole = whole * 10 + (*ptr++ - '0');
+  if (*ptr == '.') {
+    ptr++;
+    for(; *ptr >= '0' && *ptr <= '9'; ptr++) {
+      if (digits == 4) continue; // more than we need
+      frac = frac * 10 + (*ptr - '0');
+      digits++;
+    }
+  }
+  for(; digits < 4; digits++) frac *= 10;
+  // The minutes, in ten thousandths. 6000 of those is a hundredth of a degree.
+  unsigned long minutes = (whole % 100) * 10000 + frac;
+  int value = (int)((whole / 100) * 100 + (minutes + 3000) / 6000);
+  if (*ptr++ != ',') return AIDING_BAD;
+  if (*ptr == 'S' || *ptr == 'W') return -value;
+  if (*ptr == 'N' || *ptr == 'E') return value;
+  return AIDING_BAD;
+}
+
+// Message 0x01 - restart the receiver, with a position and (if it can be
+// trusted) a time as hints. The time is nmea_to_utc() backwards.
+static unsigned char aiding_restart(const struct aiding *a, const unsigned char with_time) {
+  unsigned char msg[15];
+  memset(msg, 0, sizeof(msg));
+  msg[0] = 0x01;
+  msg[1] = with_time ? AIDING_START_MODE : AIDING_WARM_START_MODE;
+  msg[9] = (unsigned int)a->lat >> 8;
+  msg[10] = a->lat & 0xff;
+  msg[11] = (unsigned int)a->lon >> 8;
+  msg[12] = a->lon & 0xff;
+  msg[13] = (unsigned int)a->alt >> 8;
+  msg[14] = a->alt & 0xff;
+  if (!with_time) return skytraq_send(msg, sizeof(msg));
+
+  unsigned long since = a->utc - 946684800UL;
+  unsigned int days = since / 86400;
+  unsigned long secs = since % 86400;
+  unsigned char year = 0, month = 12, leap;
+  while(1) {
+    unsigned int year_days = (year & 3) ? 365 : 366;
+    if (days < year_days) break;
+    days -= year_days;
+    year++;
   }
+  leap = ((year & 3) == 0);
+  while(pgm_read_word(&(month_days[month - 1])) + ((leap && month > 2) ? 1 : 0) > days) month--;
+  days -= pgm_read_word(&(month_days[month - 1])) + ((leap && month > 2) ? 1 : 0);
+  msg[2] = (2000 + year) >> 8;
+  msg[3] = (2000 + year) & 0xff;
+  msg[4] = month;
+  msg[5] = days + 1;
+  msg[6] = secs / 3600;
+  msg[7] = (secs / 60) % 60;
+  msg[8] = secs % 60;
+  return skytraq_send(msg, sizeof(msg));
+}
+
+// Save the last position the receiver reported, with the current time.
+static void save_aiding(const unsigned char power_fail) {
+  if (aiding_now.magic != AIDING_MAGIC || utc_second == 0) return;
+  aiding_now.utc = utc_second;
+  aiding_now.power_fail = power_fail;
+  eeprom_update_block(&aiding_now, &ee_aiding, sizeof(aiding_now));
 }
+#endif
 
 // Optimization beyond O2 turns this into a jump table, which is a step backwards
 // on a Harvard machine.
@@ -509,12 +1658,29 @@ static unsigned int __attribute__((optimize("O1"))) mode_to_tc(const unsigned ch
 }
 
 static void reset_pll() {
+#ifdef JUMP_DETECT
+  if (jump_boost) {
+    // Put the iTerm back in terms of the normal time constant.
+    iTerm *= JUMP_BOOST;
+#ifdef DRIFT_TERM
+    dTerm *= JUMP_BOOST;
+#endif
+    jump_boost = 0;
+  }
+  jump_filled = 0;
+#endif
   if (mode != MODE_START) {
     // if we're exiting the PLL, then at least take the most recent
     // adjustment value we had and add it back to the trim value for free-running.
     trim_value -= iTerm / mode_to_tc(mode);
+#ifdef DRIFT_TERM
+    trim_value -= dTerm / mode_to_tc(mode);
+#endif
   }
   iTerm = 0.;
+#ifdef DRIFT_TERM
+  dTerm = 0.;
+#endif
   average_phase_error = 0.;
   average_pps_error = 0.;
   mode = MODE_START;
@@ -522,19 +1688,83 @@ static void reset_pll() {
 }
 
 static void downgrade_mode() {
+#ifdef JUMP_DETECT
+  if (jump_boost) {
+    // The boost only runs in the slow mode. Leaving it ends the boost.
+    iTerm *= JUMP_BOOST;
+#ifdef DRIFT_TERM
+    dTerm *= JUMP_BOOST;
+#endif
+    jump_boost = 0;
+  }
+#endif
   mode--;
   exit_timer = 0;
   // translate the iTerm whenever we change the time constant.
   double ratio = ((double)mode_to_tc(mode))/((double)mode_to_tc(mode + 1));
   iTerm *= ratio;
+#ifdef DRIFT_TERM
+  dTerm *= ratio;
+#endif
+}
+
+#ifdef POWER_FAIL
+static uint16_t checkpoint_crc(const struct checkpoint *c) {
+  uint16_t crc = 0xffff;
+  const unsigned char *ptr = (const unsigned char *)c;
+  for(int i = 0; i < offsetof(struct checkpoint, crc); i++)
+    crc = _crc16_update(crc, ptr[i]);
+  return crc;
 }
 
+// Measure the supply voltage in mV. The phase detector reading needs the
+// 1.1 volt internal reference, so we switch to AVCC as the reference (and
+// the bandgap as the input), then switch back. AVCC drives AREF up quickly,
+// so a few throwaway conversions are enough going that way, but the way
+// back has to wait REF_SETTLE_MS for AREF to come down.
+static unsigned int read_vcc() {
+  unsigned int reading = 0;
+  adc_borrowed = 1;
+  ADMUX = _BV(REFS0) | _BV(MUX3) | _BV(MUX2) | _BV(MUX1); // AVCC is ref, 1.1V bandgap is the input
+  for(int i = 0; i < 4; i++) {
+    ADCSRA |= _BV(ADSC);
+    while(ADCSRA & _BV(ADSC)) ;
+    reading = ADC;
+  }
+  ADMUX = _BV(REFS0) | _BV(REFS1); // 1.1V is ref, ADC0 is the input
+  _delay_ms(REF_SETTLE_MS);
+  ADCSRA |= _BV(ADSC); // the first conversion after a change is thrown away
+  while(ADCSRA & _BV(ADSC)) ;
+  adc_borrowed = 0;
+  if (reading == 0) return 0xffff; // that can't be right
+  return (unsigned int)((1100UL * 1024) / reading);
+}
+
+static void save_checkpoint() {
+  struct checkpoint c;
+  c.magic = CHECKPOINT_MAGIC;
+  c.trim_value = trim_value;
+  c.iTerm = iTerm;
+#ifdef DRIFT_TERM
+  c.dTerm = dTerm;
+#else
+  c.dTerm = 0.;
+#endif
+  c.mode = mode;
+  c.crc = checkpoint_crc(&c);
+  eeprom_update_block(&c, &ee_checkpoint, sizeof(c));
+}
+#endif
+
 // main() is void, and we never return from it.
 void __ATTR_NORETURN__ main() {
   // This must be done as early as possible to prevent the watchdog from biting during reset.
   unsigned char mcusr_value = MCUSR;
   MCUSR = 0;
   wdt_enable(WDTO_500MS);
+#ifdef STALL_TRACE
+  WDTCSR |= _BV(WDIE); // interrupt first, then reset
+#endif
 
   // We use Timer1, USART0 and the ADC.
 #ifdef __AVR_ATmega328PB__
@@ -549,6 +1779,34 @@ void __ATTR_NORETURN__ main() {
 #endif
 
   // set up the serial port
+#ifdef AUTO_F_CPU
+  f_osc = F_CPU;
+  f_osc_known = 0;
+  osc_candidate = 0;
+  osc_matches = 0;
+#endif
+#ifdef AUTO_BAUD
+  {
+    // Start with the baud rate that worked last time, if there is one.
+    struct baud_saved b;
+    eeprom_read_block(&b, &ee_baud, sizeof(b));
+    if (b.magic == BAUD_MAGIC) {
+      serial_baud = b.baud;
+      baud_index = 0xff;
+    } else {
+      serial_baud = pgm_read_dword(&(baud_rates[0]));
+      baud_index = 0;
+    }
+  }
+  baud_found = 0;
+  baud_ubx_reported = 0;
+  baud_timer = 0;
+  rx_nmea_good = 0;
+  rx_ubx_good = 0;
+#endif
+#if defined(AUTO_F_CPU) || defined(AUTO_BAUD)
+  set_baud(F_OSC);
+#else
   // uses constants defined above in util/setbaud.h
   UBRR0H = UBRRH_VALUE;
   UBRR0L = UBRRL_VALUE;
@@ -557,6 +1815,7 @@ void __ATTR_NORETURN__ main() {
 #else
   UCSR0A = 0;
 #endif
+#endif
 
 // If you need to initialize the GPS, then set TXEN, transmit
 // whatever is necessary, then clear TXEN. That will make the
@@ -566,7 +1825,7 @@ void __ATTR_NORETURN__ main() {
 // controller transmits whenever. The controller can transmit
 // anything it wants - anything that's not a proper NMEA sentence
 // will be ignored by the GPS module.
-#ifdef DEBUG
+#ifdef SERIAL_TX
   UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0); // transmit always for debug
 #else
   UCSR0B = _BV(RXCIE0) | _BV(RXEN0);
@@ -589,10 +1848,18 @@ void __ATTR_NORETURN__ main() {
   DAC_PORT |= DAC_CS;
   DAC_DDR = 0;
   DAC_DDR |= DAC_DDR_MSK;
+#ifdef DAC_INIT_FRAME
+  dac_send(DAC_INIT_FRAME);
+#endif
 
   // Set up timer1
   TCCR1A = 0; // Normal mode
+#ifdef PPS_FILTER
+  TCCR1B = _BV(ICNC1) | _BV(ICES1) | _BV(CS10); // Noise canceler, rising edge capture, no pre-scale.
+  pps_glitches = 0;
+#else
   TCCR1B = _BV(ICES1) | _BV(CS10); // No noise reduction, rising edge capture, no pre-scale.
+#endif
   TIMSK1 = _BV(ICIE1) | _BV(TOIE1); // Interrupt on overflow and capture
   TCNT1 = 0; // clear the counter.
   timer_hibits = 0;
@@ -605,6 +1872,8 @@ void __ATTR_NORETURN__ main() {
 
   last_dac_value = 0xffffffff; // none-of-the-above value
   pps_count = 0;
+  pps_queue_head = pps_queue_tail = 0;
+  pps_overruns = 0;
   mode = MODE_START;
   reset_pll();
   gps_locked = 0;
@@ -612,12 +1881,43 @@ void __ATTR_NORETURN__ main() {
   rx_str_len = 0;
 #ifdef DEBUG
   *pdop_buf = 0; // null terminate
-  *pps_err_buf = 0;
+#endif
+#ifdef SURVEY
+  rx_binary = 0;
+  receiver_timing_mode = 0xff; // unknown
+  survey_reply_ready = 0;
+  survey_timer = 0;
+  survey_seconds = 0;
+  eeprom_read_block(&survey_saved, &ee_survey_position, sizeof(survey_saved));
+  survey_state = (survey_saved.magic == SURVEY_MAGIC) ? SURVEY_RESTORE : SURVEY_START;
+#endif
+#ifdef AIDING
+  receiver_heard = 0;
+  pos_fresh = 0;
+  *alt_buf = 0;
+  aiding_now.magic = 0;
+  aiding_now.alt = 0;
+  aiding_fix_seconds = 0;
+  eeprom_read_block(&aiding_saved, &ee_aiding, sizeof(aiding_saved));
+  aiding_pending = (aiding_saved.magic == AIDING_MAGIC);
+  // The time saved as the power failed is only good for the reset that
+  // followed, and only if the power didn't go all the way off.
+  aiding_time_ok = aiding_pending && aiding_saved.power_fail && !(mcusr_value & _BV(PORF));
+  if (aiding_saved.power_fail) eeprom_update_byte(&ee_aiding.power_fail, 0);
+#endif
+#ifdef UTC_TAG
   *time_buf = 0;
   *date_buf = 0;
+  time_fresh = 0;
+  utc_second = 0; // unknown until the first valid $GPRMC or $GPZDA
 #endif
 #ifdef SERIAL_TX
   txbuf_head = txbuf_tail = 0; // clear the transmit buffer
+  tx_dropped = 0;
+#endif
+#ifdef DEBUG
+  log_level = LOG_FULL;
+  log_quiet_seconds = 0;
 #endif
 
 #ifdef DEBUG
@@ -627,28 +1927,133 @@ void __ATTR_NORETURN__ main() {
   if (mcusr_value & _BV(EXTRF)) tx_pstr(PSTR("RES_EXT\r\n")); // external reset
   if (mcusr_value & _BV(BORF)) tx_pstr(PSTR("RES_BO\r\n")); // brown-out reset
   if (mcusr_value & _BV(WDRF)) tx_pstr(PSTR("RES_WD\r\n")); // watchdog reset
+#elif defined(EVENT_LOG)
+  log_event(EV_START, mcusr_value, 0, 0);
+#endif
+#ifdef STALL_TRACE
+#ifdef DEBUG
+  if (mcusr_value & _BV(WDRF)) {
+    char buf[8];
+    // STALL = where the watchdog found us stuck: the program (byte) address,
+    // or ? if an ISR was stuck, then the ISR and the main loop stage.
+    tx_pstr(PSTR("STALL="));
+    if (stall_magic == STALL_MAGIC) {
+      utoa(stall_pc, buf, 16);
+      tx_str(buf);
+    } else {
+      tx_char('?');
+    }
+    tx_char(',');
+    utoa(stall_isr, buf, 10);
+    tx_str(buf);
+    tx_char(',');
+    utoa(stall_stage, buf, 10);
+    tx_str(buf);
+    tx_pstr(PSTR("\r\n"));
+  }
+#elif defined(EVENT_LOG)
+  if (mcusr_value & _BV(WDRF))
+    log_event(EV_STALL, (stall_magic == STALL_MAGIC) ? (long)stall_pc : -1L, stall_isr, stall_stage);
+#endif
+  stall_magic = 0;
+  stall_isr = STALL_ISR_NONE;
+  stall_stage = STAGE_IDLE;
 #endif
 
   // the default value of the DAC is midpoint, so nothing needs to be done.
   trim_value = 0.;
+#ifdef POWER_FAIL
+  power_failing = 0;
+  last_power_check = 0;
+  {
+    // If we saved our state when the power last failed, free-run from the
+    // frequency the loop was holding at the time (just as reset_pll() would
+    // have left it), rather than from the midpoint.
+    struct checkpoint c;
+    eeprom_read_block(&c, &ee_checkpoint, sizeof(c));
+    if (c.magic == CHECKPOINT_MAGIC && c.crc == checkpoint_crc(&c)) {
+      trim_value = c.trim_value;
+      if (c.mode != MODE_START) trim_value -= (c.iTerm + c.dTerm) / mode_to_tc(c.mode);
+      if (trim_value > DAC_MIDPOINT) trim_value = DAC_MIDPOINT;
+      if (trim_value < -DAC_MIDPOINT) trim_value = -DAC_MIDPOINT;
+      writeDacValue((long)(DAC_SIGN * trim_value) + DAC_MIDPOINT);
+#ifdef WARMUP
+      warmup_ckpt = 1;
+      warmup_ckpt_freq = -trim_value / GAIN;
+#endif
+#ifdef DEBUG
+      char buf[12];
+      // CKPT = the trim value restored from the power-fail checkpoint, and the mode it was saved in.
+      tx_pstr(PSTR("CKPT="));
+      dtostrf(trim_value, 7, 2, buf);
+      tx_str(buf);
+      tx_char(',');
+      utoa(c.mode, buf, 10);
+      tx_str(buf);
+      tx_pstr(PSTR("\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_CKPT, lround(trim_value * 100), c.mode, 0);
+#endif
+    }
+  }
+#endif
+#ifdef HANGING_BRIDGE
+  last_pps_err = 0.;
+  average_qe_step = 0.;
+  average_qe_size = 0.;
+  hanging_bridge = 0;
+#endif
+#ifdef WARMUP
+  warming_up = 1;
+  warmup_windows = 0;
+  warmup_stable = 0;
+  warmup_seconds = 0;
+  warmup_cycles = 0;
+#endif
+#ifdef JUMP_DETECT
+  jump_filled = 0;
+  jump_confirm = 0;
+  jump_settle = 0;
+  jump_baseline = 0.;
+#endif
+#ifdef PHASE_DITHER
+  dither_setpoint = 0;
+  dither_direction = 1;
+  dither_timer = 0;
+#endif
+
+#ifdef MEASURE
+  measure_started = 0;
+  measure_wraps = 0;
+  writeDacValue(MEASURE_DAC);
+#endif
 
   sei();
 
   while(1) {
+#ifdef UTC_TAG
     static unsigned long last_pps_count = 0;
+#endif
  
     // Pet the dog
     wdt_reset();
+#ifdef STALL_TRACE
+    stall_stage = STAGE_IDLE;
+#endif
 
     if (gps_locked != last_gps_locked) {
       last_gps_locked = gps_locked;
       if (gps_locked) {
 #ifdef DEBUG
         tx_pstr(PSTR("G_LK\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_G_LK, 0, 0, 0);
 #endif
       } else {
 #ifdef DEBUG
         tx_pstr(PSTR("G_UN\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_G_UN, 0, 0, 0);
 #endif
         // Whenever the GPS unlocks, back down one PLL time constant step. We don't
 	// attempt to track how long we've held over, but a faster TC means less averaging,
@@ -672,8 +2077,8 @@ void __ATTR_NORETURN__ main() {
       else
         LED_PORT &= ~LED1;
     } else {
-      unsigned int blink_pos = timer_hibits % (F_CPU / 65536);
-      blink_pos = (4 * blink_pos) / (F_CPU / 65536);
+      unsigned int blink_pos = timer_hibits % (F_OSC / 65536);
+      blink_pos = (4 * blink_pos) / (F_OSC / 65536);
       if (blink_pos & 1) {
         LED_PORT |= LED0;
         LED_PORT &= ~LED1;
@@ -683,64 +2088,540 @@ void __ATTR_NORETURN__ main() {
       }
     }
 
-    // If we haven't had a PPS event and gotten a quant error value since we were last here, we're done.
-    if (last_pps_count == pps_count || *pps_err_buf == 0) continue;
-    last_pps_count = pps_count;
+#ifdef POWER_FAIL
+    if ((unsigned int)(timer_hibits - last_power_check) >= POWER_CHECK_TICKS) {
+      unsigned long since_pps;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        since_pps = timer_now() - pps_time;
+      }
+      // Stay well clear of where the next PPS is due, unless there's no sign of one.
+      if (since_pps > (F_OSC * 11) / 10 || (since_pps > F_OSC / 20 && since_pps < (F_OSC * 17) / 20)) {
+        last_power_check = timer_hibits;
+#ifdef STALL_TRACE
+        stall_stage = STAGE_POWER;
+#endif
+        unsigned int vcc = read_vcc();
+        if (!power_failing && vcc < POWER_FAIL_MV) {
+          power_failing = 1;
+          save_checkpoint();
+#ifdef AIDING
+          save_aiding(1);
+#endif
+#ifdef DEBUG
+          char buf[8];
+          // PWR_FAIL = the supply dropped to this many mV, and the state was saved.
+          tx_pstr(PSTR("PWR_FAIL="));
+          utoa(vcc, buf, 10);
+          tx_str(buf);
+          tx_pstr(PSTR("\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_PWR_FAIL, vcc, 0, 0);
+#endif
+        } else if (power_failing && vcc > POWER_OK_MV) {
+          power_failing = 0;
+#ifdef AIDING
+          // We rode it out, so the time just saved will only get older.
+          eeprom_update_byte(&ee_aiding.power_fail, 0);
+#endif
+#ifdef DEBUG
+          tx_pstr(PSTR("PWR_OK\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_PWR_OK, 0, 0, 0);
+#endif
+        }
+      }
+    }
+#endif
+
+#ifdef AUTO_BAUD
+    {
+      unsigned char nmea_good, ubx_good;
+      unsigned int now;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        nmea_good = rx_nmea_good;
+        ubx_good = rx_ubx_good;
+        now = timer_hibits;
+      }
+      if (!baud_found) {
+        unsigned char proto = 0xff;
+        if (nmea_good >= BAUD_GOOD) {
+          struct baud_saved b;
+          proto = PROTO_NMEA;
+          baud_found = 1;
+          baud_timer = now;
+          b.magic = BAUD_MAGIC;
+          b.baud = serial_baud;
+          eeprom_update_block(&b, &ee_baud, sizeof(b));
+        } else if (ubx_good >= BAUD_GOOD && !baud_ubx_reported) {
+          // A u-blox receiver that's been set to UBX only. There's no NMEA
+          // to be had at this rate, so it isn't saved, and the search goes
+          // on (in case it's set back). Only say so the first time.
+          proto = PROTO_UBX;
+          baud_ubx_reported = 1;
+        } else if ((unsigned int)(now - baud_timer) >= BAUD_TRY_TICKS) {
+          // Nothing yet. On to the next one.
+          if (++baud_index >= sizeof(baud_rates) / sizeof(baud_rates[0])) baud_index = 0;
+          serial_baud = pgm_read_dword(&(baud_rates[baud_index]));
+          baud_timer = now;
+          ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            set_baud(F_OSC);
+            rx_str_len = 0; // anything half received was at the old rate
+#ifdef SURVEY
+            rx_binary = 0;
+#endif
+            rx_nmea_good = 0;
+            rx_ubx_good = 0;
+          }
+        }
+        if (proto != 0xff) {
+#ifdef DEBUG
+          char buf[12];
+          // BAUD = the receiver's baud rate, and the protocol it's speaking.
+          tx_pstr(PSTR("BAUD="));
+          ultoa(serial_baud, buf, 10);
+          tx_str(buf);
+          tx_pstr((proto == PROTO_NMEA) ? PSTR(",NMEA\r\n") : PSTR(",UBX\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_BAUD, serial_baud, proto, 0);
+#endif
+        }
+      } else if (nmea_good) {
+        // Only NMEA counts. A receiver that's been switched to UBX only
+        // is as good as gone.
+        baud_timer = now;
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+          rx_nmea_good = 0;
+          rx_ubx_good = 0;
+        }
+      } else if ((unsigned int)(now - baud_timer) >= BAUD_LOST_TICKS) {
+        // The receiver has gone quiet, or changed its baud rate. Try this
+        // one again first, then the rest.
+        baud_found = 0;
+        baud_timer = now;
+#ifdef DEBUG
+        tx_pstr(PSTR("BAUD_LOST\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_BAUD_LOST, 0, 0, 0);
+#endif
+      }
+    }
+#endif
+
+#ifdef AIDING
+    // Once the receiver is talking (there's no telling how long it takes
+    // to start up), restart it with the saved hints - unless it already
+    // has a fix, which it will if it's only us that was reset. Unless the
+    // saved time is known to be fresh, only the position goes.
+    if (aiding_pending && receiver_heard) {
+      if (gps_locked) {
+        aiding_pending = 0;
+      } else if (aiding_restart(&aiding_saved, aiding_time_ok)) {
+        aiding_pending = 0;
+#ifdef DEBUG
+        char buf[8];
+        // AID = the receiver was restarted with this latitude, longitude (1/100 degrees) and altitude (m).
+        tx_pstr(PSTR("AID="));
+        itoa(aiding_saved.lat, buf, 10);
+        tx_str(buf);
+        tx_char(',');
+        itoa(aiding_saved.lon, buf, 10);
+        tx_str(buf);
+        tx_char(',');
+        itoa(aiding_saved.alt, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_AID, aiding_saved.lat, aiding_saved.lon, aiding_saved.alt);
+#endif
+      }
+    }
+#endif
+
+    // If there's no PPS sample waiting, we're done. If the only one waiting
+    // is still waiting for its quant error value, wait with it. If it's
+    // not the newest one, its QE can only be in a sentence that started
+    // before the newest PPS and is still coming in, so wait for that to
+    // end. Otherwise, its QE isn't coming.
+    unsigned char tail = pps_queue_tail;
+    if (tail == pps_queue_head) continue;
+    unsigned char next_tail = (tail + 1) & (PPS_QUEUE_LEN - 1);
+    if (!pps_queue[tail].qe_ready) {
+      if (next_tail == pps_queue_head) continue;
+      if (straddle_pending(pps_queue[tail].sequence)) continue;
+    }
+    struct pps_sample capture;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      memcpy(&capture, (const void *)&(pps_queue[tail]), sizeof(capture));
+      pps_queue_tail = next_tail;
+    }
+#ifdef UTC_TAG
+    last_pps_count = capture.sequence;
+#endif
+#ifdef STALL_TRACE
+    stall_stage = STAGE_RECORD;
+#endif
 
+#ifdef AUTO_F_CPU
+    if (!f_osc_known) {
+      // Until enough PPS intervals in a row agree on what the oscillator
+      // is, there's nothing else we can do. A missed PPS can make one
+      // interval look like a slower oscillator, but not several in a row.
+      unsigned long f = osc_match(capture.span);
+      if (f == 0 || f != osc_candidate) {
+        osc_candidate = f;
+        osc_matches = 0;
+      }
+      if (f != 0 && ++osc_matches >= OSC_DETECT_COUNT) {
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+          f_osc = f; // the receive ISR uses it too.
+        }
+        f_osc_known = 1;
+        set_baud(f_osc);
 #ifdef DEBUG
+        char buf[12];
+        // OSC = the oscillator frequency, in Hz.
+        tx_pstr(PSTR("OSC="));
+        ultoa(f_osc, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_OSC, f_osc, 0, 0);
+#endif
+      }
+      continue;
+    }
+#endif
+
+#ifdef UTC_TAG
+    char temp_date_buf[7], temp_time_buf[7];
     {
-      char temp_date_buf[7], temp_time_buf[7];
+      unsigned char fresh;
+      unsigned long anchor_pps_count, span = capture.span;
       ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
         strcpy(temp_date_buf, (char *)date_buf);
         strcpy(temp_time_buf, (char *)time_buf);
+        fresh = time_fresh;
+        time_fresh = 0;
+        anchor_pps_count = time_pps_count;
+      }
+      // Every record is tagged with the UTC second of its PPS. Between
+      // time sentences (and through holdover), we carry it forward by
+      // the number of whole seconds this capture spanned.
+      if (utc_second != 0) utc_second += (span + F_OSC / 2) / F_OSC;
+      if (fresh) {
+        unsigned long anchor = nmea_to_utc(temp_date_buf, temp_time_buf);
+        if (anchor != 0) utc_second = anchor + (last_pps_count - anchor_pps_count);
+      }
+    }
+#endif
+
+#ifdef RAW_CAPTURE
+    {
+      struct raw_sample raw;
+      raw.pps = capture.sequence;
+      raw.utc = utc_second;
+      raw.timestamp = capture.timestamp;
+      raw.span = capture.span;
+      raw.adc = capture.adc;
+      raw.gsa_latency = capture.gsa_latency;
+      raw.rmc_latency = capture.rmc_latency;
+      raw.flags = gps_locked ? RAW_LOCKED : 0;
+      if (capture.qe_ready) {
+        raw.flags |= RAW_QE;
+        raw.qe_latency = capture.qe_latency;
+        memcpy(raw.qe, capture.qe, sizeof(raw.qe));
+      } else {
+        raw.qe_latency = 0;
+        memset(raw.qe, 0, sizeof(raw.qe));
+      }
+      tx_frame('R', &raw, sizeof(raw));
+    }
+#endif
+
+#ifdef AIDING
+    {
+      // Keep up with where the receiver says we are. Once it has been
+      // saying so for a while, save that for the next boot.
+      char temp_pos_buf[sizeof(pos_buf)], temp_alt_buf[sizeof(alt_buf)];
+      unsigned char fresh;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        strcpy(temp_pos_buf, (char *)pos_buf);
+        strcpy(temp_alt_buf, (char *)alt_buf);
+        fresh = pos_fresh;
+        pos_fresh = 0;
+      }
+      if (fresh) {
+        char *lon_ptr = skip_commas(temp_pos_buf, 2);
+        int lat = nmea_to_centidegrees(temp_pos_buf);
+        int lon = (lon_ptr == NULL) ? AIDING_BAD : nmea_to_centidegrees(lon_ptr);
+        if (lat != AIDING_BAD && lon != AIDING_BAD) {
+          aiding_now.magic = AIDING_MAGIC;
+          aiding_now.lat = lat;
+          aiding_now.lon = lon;
+          if (*temp_alt_buf) aiding_now.alt = atoi(temp_alt_buf);
+          if (aiding_fix_seconds < AIDING_SAVE_DELAY && ++aiding_fix_seconds == AIDING_SAVE_DELAY) save_aiding(0);
+        }
+      }
+    }
+#endif
+
+#ifdef DEBUG
+    // Figure out how much of this second we can afford to log.
+    unsigned char log_record;
+    {
+      static unsigned int last_tx_dropped = 0;
+      unsigned int in_use = tx_buf_in_use();
+      if (in_use > TX_BUF_LEN / 2) {
+        log_quiet_seconds = 0;
+        if (log_level > LOG_EVENTS) {
+          log_level--;
+          tx_pstr(PSTR("LOG_DN\r\n"));
+        }
+      } else if (in_use == 0 && log_level < LOG_FULL) {
+        if (++log_quiet_seconds >= LOG_UPSHIFT_SECONDS) {
+          log_quiet_seconds = 0;
+          log_level++;
+          tx_pstr(PSTR("LOG_UP\r\n"));
+        }
+      } else {
+        log_quiet_seconds = 0;
+      }
+      static unsigned int last_pps_overruns = 0;
+      unsigned int overruns;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        overruns = pps_overruns;
+      }
+      if (overruns != last_pps_overruns) {
+        char buf[8];
+        // OVR = the running count of PPS samples dropped because the main loop fell behind.
+        last_pps_overruns = overruns;
+        tx_pstr(PSTR("OVR="));
+        utoa(overruns, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
+      }
+#ifdef PPS_FILTER
+      static unsigned int last_pps_glitches = 0;
+      unsigned int glitches;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        glitches = pps_glitches;
       }
-      if (strlen(temp_date_buf) > 0 && strlen(temp_time_buf) > 0) {
+      if (glitches != last_pps_glitches) {
+        char buf[8];
+        // GLT = the running count of PPS edges thrown away as glitches.
+        last_pps_glitches = glitches;
+        tx_pstr(PSTR("GLT="));
+        utoa(glitches, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
+      }
+#endif
+      if (tx_dropped != last_tx_dropped) {
+        char buf[8];
+        // TXD = the running count of debug characters dropped because the buffer was full.
+        last_tx_dropped = tx_dropped;
+        tx_pstr(PSTR("TXD="));
+        utoa(last_tx_dropped, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
+      }
+      if (last_pps_count % RX_TIMING_INTERVAL == 0) {
+        // LT = sentence timing: the type, how many were seen, the min, mean and max
+        // time from the PPS to its '$', and the mean time from '$' to the end
+        // of the line, all in microseconds.
+        for(unsigned char type = 0; type < RX_TYPES; type++) {
+          struct rx_timing t;
+          ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            memcpy(&t, (const void *)&(rx_timing[type]), sizeof(t));
+            rx_timing[type].count = 0;
+            rx_timing[type].sum = 0;
+            rx_timing[type].length_sum = 0;
+          }
+          if (t.count == 0) continue;
+          char buf[12];
+          double us_per_count = 1000000.0 / F_OSC;
+          tx_pstr(PSTR("LT="));
+          tx_pstr(rx_type_names[type]);
+          tx_char(',');
+          utoa(t.count, buf, 10);
+          tx_str(buf);
+          tx_char(',');
+          ultoa((unsigned long)(t.min * us_per_count), buf, 10);
+          tx_str(buf);
+          tx_char(',');
+          ultoa((unsigned long)(t.sum / t.count * us_per_count), buf, 10);
+          tx_str(buf);
+          tx_char(',');
+          ultoa((unsigned long)(t.max * us_per_count), buf, 10);
+          tx_str(buf);
+          tx_char(',');
+          ultoa((unsigned long)(t.length_sum / t.count * us_per_count), buf, 10);
+          tx_str(buf);
+          tx_pstr(PSTR("\r\n"));
+        }
+      }
+      log_record = (log_level == LOG_FULL) || (log_level == LOG_SUMMARY && last_pps_count % LOG_SUMMARY_INTERVAL == 0);
+    }
+
+    {
+      if (log_record && strlen(temp_date_buf) > 0 && strlen(temp_time_buf) > 0) {
         tx_pstr(PSTR("DT="));
         tx_str(temp_date_buf);
         tx_char(' ');
         tx_str(temp_time_buf);
         tx_pstr(PSTR("\r\n"));
       }
+      if (log_record && utc_second != 0) {
+        char buf[12];
+        // TS = Time Stamp - the UTC second (Unix time) of the PPS this record describes.
+        tx_pstr(PSTR("TS="));
+        ultoa(utc_second, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
+      }
+    }
+#endif
+#ifdef EVENT_LOG
+    {
+      static unsigned int last_pps_overruns = 0;
+      static unsigned int last_tx_dropped = 0;
+      unsigned int overruns;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        overruns = pps_overruns;
+      }
+      if (overruns != last_pps_overruns) {
+        last_pps_overruns = overruns;
+        log_event(EV_OVR, overruns, 0, 0);
+      }
+#ifdef PPS_FILTER
+      static unsigned int last_pps_glitches = 0;
+      unsigned int glitches;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        glitches = pps_glitches;
+      }
+      if (glitches != last_pps_glitches) {
+        last_pps_glitches = glitches;
+        log_event(EV_GLT, glitches, 0, 0);
+      }
+#endif
+      if (tx_dropped != last_tx_dropped) {
+        last_tx_dropped = tx_dropped;
+        log_event(EV_TXD, last_tx_dropped, 0, 0);
+      }
+    }
+#endif
+
+#ifdef SURVEY
+    {
+      unsigned char timing_mode = receiver_timing_mode;
+      unsigned char last_state = survey_state;
+      switch(survey_state) {
+        case SURVEY_START:
+          // If the receiver has already surveyed (we were reset, but it
+          // wasn't), all that's left is to get the result.
+          if (timing_mode == TIMING_STATIC) survey_state = SURVEY_QUERY;
+          else if (timing_mode == TIMING_SURVEY) survey_state = SURVEY_RUNNING;
+          else if (survey_timer == 0 && survey_configure(TIMING_SURVEY, NULL)) survey_timer = SURVEY_RETRY;
+          break;
+        case SURVEY_RUNNING:
+          survey_seconds++;
+          if (timing_mode == TIMING_STATIC) survey_state = SURVEY_QUERY;
+          else if (timing_mode != TIMING_SURVEY) survey_state = SURVEY_START; // the receiver reset
+          break;
+        case SURVEY_QUERY:
+          if (survey_reply_ready) {
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+              memcpy(survey_saved.position, (const void*)survey_reply, sizeof(survey_saved.position));
+              survey_reply_ready = 0;
+            }
+            survey_saved.magic = SURVEY_MAGIC;
+            eeprom_update_block(&survey_saved, &ee_survey_position, sizeof(survey_saved));
+            survey_state = SURVEY_HOLD;
+          } else if (survey_timer == 0) {
+            const unsigned char query = 0x44; // query the timing mode
+            if (skytraq_send(&query, 1)) survey_timer = SURVEY_RETRY;
+          }
+          break;
+        case SURVEY_RESTORE:
+          if (timing_mode == TIMING_STATIC) survey_state = SURVEY_HOLD;
+          else if (survey_timer == 0 && survey_configure(TIMING_STATIC, survey_saved.position)) survey_timer = SURVEY_RETRY;
+          break;
+        case SURVEY_HOLD:
+          // If the receiver resets, it'll come back in PVT mode.
+          if (timing_mode != TIMING_STATIC) survey_state = SURVEY_RESTORE;
+          break;
+      }
+      if (survey_timer != 0) survey_timer--;
+      if (survey_state != last_state) survey_timer = 0;
+#ifdef DEBUG
+      if (survey_state != last_state) {
+        char buf[8];
+        // SV = the survey state changed.
+        tx_pstr(PSTR("SV="));
+        utoa(survey_state, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
+        if (survey_state == SURVEY_HOLD && last_state == SURVEY_QUERY) tx_pstr(PSTR("SV_SAVED\r\n"));
+      }
+#elif defined(EVENT_LOG)
+      if (survey_state != last_state) {
+        log_event(EV_SV, survey_state, 0, 0);
+        if (survey_state == SURVEY_HOLD && last_state == SURVEY_QUERY) log_event(EV_SV_SAVED, 0, 0, 0);
+      }
+#endif
+#ifdef DEBUG
+      if (log_record && survey_state == SURVEY_RUNNING) {
+        char buf[8];
+        // SVT = how long the survey has been running.
+        tx_pstr(PSTR("SVT="));
+        utoa(survey_seconds, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n"));
+      }
+#endif
     }
 #endif
 
     if (!gps_locked) {
 #ifdef DEBUG
       // FR - Free Running - GPS is unlocked.
-      tx_pstr(PSTR("FR\r\n\r\n"));
+      if (log_record) tx_pstr(PSTR("FR\r\n\r\n"));
 #endif
-      pps_err_buf[0] = 0; // clear it out.
       continue;
     }
 
+    // A sample whose QE never showed up can't be used.
+    if (!capture.qe_ready) continue;
+#ifdef POWER_FAIL
+    // Nor can one captured while read_vcc() had the ADC.
+    if (capture.adc == ADC_BORROWED) continue;
+#endif
+
     double pps_err;
     {
-      char temp[5];
-      ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-        strcpy(temp, (const char*) pps_err_buf); // it's volatile, so make a copy atomically.
-        pps_err_buf[0] = 0; // clear it out.
-      }
 #ifdef DEBUG
-      tx_pstr(PSTR("QE="));
-      tx_str(temp);
-      tx_pstr(PSTR("\r\n"));
+      if (log_record) {
+        tx_pstr(PSTR("QE="));
+        tx_str(capture.qe);
+        tx_pstr(PSTR("\r\n"));
+      }
 #endif
-      pps_err = atof(temp);
+      pps_err = atof(capture.qe);
     }
 
-    long pps_cycle_delta = irq_time_span - F_CPU;
+    long pps_cycle_delta = capture.span - F_OSC;
 
     // round to the nearest second. It's impossible for this to
     // wind up being negative, given reasonably correct GPS behavior.
-    unsigned long seconds_delta = (pps_cycle_delta + F_CPU/2) / F_CPU;
+    unsigned long seconds_delta = (pps_cycle_delta + F_OSC/2) / F_OSC;
     // This is what's left when the whole seconds are accounted for.
     // The result of all this is that a delta of F_CPU - 1 results
     // not in a seconds_delta of 0 and an intracycle_delta of F_CPU-1,
     // but rather a seconds_delta of 1 and an intracycle delta of -1,
     // which is a much better description of the behavior.
-    long intracycle_delta = pps_cycle_delta - ((long)(seconds_delta * F_CPU));
+    long intracycle_delta = pps_cycle_delta - ((long)(seconds_delta * F_OSC));
 
-    if (labs(intracycle_delta) / (seconds_delta + 1) > (F_CPU / 100000)) { // this would be an error of 100 ppm - impossible
+    if (labs(intracycle_delta) / (seconds_delta + 1) > (F_OSC / 100000)) { // this would be an error of 100 ppm - impossible
 #ifdef DEBUG
       char buf[16];
       // XXI - an erroneous intracycle delta. A delta of more than 100 ppm is reported, but skipped/ignored.
@@ -751,6 +2632,8 @@ void __ATTR_NORETURN__ main() {
       ltoa(seconds_delta, buf, 10);
       tx_str(buf);
       tx_pstr(PSTR("\r\n\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_XXI, intracycle_delta, seconds_delta, 0);
 #endif
       continue;
     }
@@ -764,27 +2647,224 @@ void __ATTR_NORETURN__ main() {
       ltoa(seconds_delta, buf, 10);
       tx_str(buf);
       tx_pstr(PSTR("\r\n\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_XXS, seconds_delta, 0, 0);
 #endif
     }
 
+#ifdef MEASURE
+    {
+      // The cycle count tells us how far the phase moved in 100 ns steps, and
+      // the phase detector (with QE correction) tells us where it is to the
+      // nanosecond, but only modulo PHASE_WRAP. Count the wraps that make the
+      // two agree, and we have a phase that can run on indefinitely.
+      // Captures the loop skips (with no fix or no QE, or an XXI) never
+      // get this far, so the time since the last one that did is taken
+      // from the UTC seconds, or from the timer if they aren't known. The
+      // cycle count error is what's left of the timer counts after that.
+      unsigned long elapsed;
+      if (utc_second != 0 && measure_last_utc != 0) elapsed = utc_second - measure_last_utc;
+      else elapsed = (capture.timestamp - measure_last_timestamp + F_OSC / 2) / F_OSC;
+      if (elapsed > MEASURE_MAX_GAP) measure_started = 0;
+      long cycles = (long)(capture.timestamp - measure_last_timestamp - elapsed * F_OSC);
+      if (!measure_started) {
+        elapsed = 0;
+        cycles = 0;
+      }
+      measure_last_utc = utc_second;
+      measure_last_timestamp = capture.timestamp;
+
+      double fine_phase = (double)PHASE_ADC_MIDPOINT - capture.adc + QE_COMPENSATION * pps_err;
+      if (measure_started) {
+        double coarse_step = (1000000000.0 / F_OSC) * cycles;
+        measure_wraps += lround((coarse_step - (fine_phase - measure_last_phase)) / PHASE_WRAP);
+      }
+      measure_last_phase = fine_phase;
+      long phase = lround(fine_phase * 10) + measure_wraps * (PHASE_WRAP * 10L);
+
+      struct measure_sample sample;
+      sample.pps = last_pps_count;
+      sample.utc = utc_second;
+      sample.phase = phase;
+      sample.cycles = cycles;
+      sample.adc = capture.adc;
+      sample.qe = (int)lround(pps_err * 10);
+      sample.seconds = elapsed;
+      tx_frame('M', &sample, sizeof(sample));
+
+      for(int i = 0; i < MEASURE_GATE_COUNT; i++) {
+        if (!measure_started) {
+          measure_gate_start[i] = phase;
+          measure_gate_time[i] = 0;
+          continue;
+        }
+        measure_gate_time[i] += elapsed;
+        if (measure_gate_time[i] < pgm_read_word(&(measure_gates[i]))) continue;
+        struct measure_freq freq;
+        freq.utc = utc_second;
+        freq.gate = measure_gate_time[i];
+        // 0.1 ns per second is 100 parts per 10^12.
+        freq.freq = lround((phase - measure_gate_start[i]) * 100.0 / measure_gate_time[i]);
+        tx_frame('F', &freq, sizeof(freq));
+        measure_gate_start[i] = phase;
+        measure_gate_time[i] = 0;
+      }
+      measure_started = 1;
+    }
+    continue;
+#endif
+
+#ifdef WARMUP
+    if (warming_up) {
+      // Add up the cycle count error over the window. A missed PPS just
+      // makes the window that much longer.
+      warmup_cycles += intracycle_delta;
+      warmup_seconds += seconds_delta + 1;
+#ifdef DEBUG
+      if (log_record) {
+        char buf[8];
+        // WU = Warm-Up - how far we are into the current warm-up window.
+        tx_pstr(PSTR("WU="));
+        utoa(warmup_seconds, buf, 10);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n\r\n"));
+      }
+#endif
+      if (warmup_seconds < WARMUP_WINDOW) continue;
+
+      // This is the frequency error in ppb the oscillator would have with the DAC
+      // at its midpoint. Taking the trim value out means our own pre-positioning
+      // doesn't show up as drift.
+      double freq = (1000000000.0 / F_OSC) * warmup_cycles / warmup_seconds - trim_value / GAIN;
+      unsigned char warm = 0;
+#ifdef POWER_FAIL
+      // If the first window finds the oscillator where the checkpoint left
+      // it, the oven never cooled (the power was only off briefly). The
+      // checkpoint's trim value is the loop's long-term average, which is
+      // far better than one window's, so keep it and go straight on to
+      // the FLL.
+      warm = (warmup_windows == 0 && warmup_ckpt && fabs(freq - warmup_ckpt_freq) <= WARMUP_DRIFT);
+#endif
+      double drift = freq - warmup_last_freq;
+      if (warmup_windows++ == 0) {
+        drift = 0.; // we need two windows to see a drift rate.
+      } else if (fabs(drift) <= WARMUP_DRIFT) {
+        warmup_stable++;
+      } else {
+        warmup_stable = 0;
+      }
+      warmup_last_freq = freq;
+      warmup_cycles = 0;
+      warmup_seconds = 0;
+
+      if (!warm) {
+        // Set the DAC for where the frequency will be by the middle of the next window.
+        trim_value = -GAIN * (freq + drift);
+        if (trim_value > DAC_MIDPOINT) trim_value = DAC_MIDPOINT;
+        if (trim_value < -DAC_MIDPOINT) trim_value = -DAC_MIDPOINT;
+      }
+      unsigned long dac_value = (long)(DAC_SIGN * trim_value) + DAC_MIDPOINT;
+      writeDacValue(dac_value);
+#ifdef DEBUG
+      {
+        char buf[10];
+        // WUF = the frequency error with the DAC at midpoint, WUD = how much it moved since the last window.
+        tx_pstr(PSTR("WUF="));
+        dtostrf(freq, 7, 2, buf);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\nWUD="));
+        dtostrf(drift, 7, 2, buf);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\nDAC=0x"));
+        ltoa(dac_value, buf, 16);
+        tx_str(buf);
+        tx_pstr(PSTR("\r\n\r\n"));
+      }
+#endif
+      if (warm || warmup_stable >= WARMUP_STABLE || warmup_windows >= WARMUP_MAX_WINDOWS) {
+        // The FLL takes it from here, starting with the DAC where we left it.
+        warming_up = 0;
+#ifdef DEBUG
+        tx_pstr(PSTR("WU_DONE\r\n\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_WU_DONE, warmup_windows, 0, 0);
+#endif
+      }
+      continue;
+    }
+#endif
+
+#ifdef STALL_TRACE
+    stall_stage = STAGE_LOOP;
+#endif
     // the time constant in START mode is the same as FAST mode.
     unsigned int time_constant = mode_to_tc(mode);
+#ifdef JUMP_DETECT
+    if (jump_boost) time_constant /= JUMP_BOOST;
+#endif
 
     // Since our ADC is 10 bits and the pulse is a microsecond wide we can fudge a little
     // and claim that each ADC count is one nanosecond. So current and average phase error
     // is in nanoseconds and is wrapped.
-    int current_phase_error = PHASE_ADC_MIDPOINT - irq_adc_value;
+    int current_phase_error = PHASE_ADC_MIDPOINT - capture.adc;
 #ifdef DEBUG
-    {
+    if (log_record) {
       char buf[8];
       tx_pstr(PSTR("RPE="));
       itoa(current_phase_error, buf, 10);
       tx_str(buf);
       tx_pstr(PSTR("\r\n"));
     }
+#endif
+#ifdef HANGING_BRIDGE
+    if (hanging_bridge) {
+      double qe_correction = QE_COMPENSATION * pps_err + qe_remainder;
+      long rounded = lround(qe_correction);
+      qe_remainder = qe_correction - rounded;
+      current_phase_error += rounded;
+    } else
 #endif
     current_phase_error += (int)((QE_COMPENSATION * pps_err) + 0.5); // quant error correction is in ns. Round to nearest
 
+#ifdef PHASE_DITHER
+    if (mode == MODE_SLOW) {
+      if (++dither_timer >= DITHER_STEP) {
+        dither_timer = 0;
+        dither_setpoint += dither_direction;
+        if (dither_setpoint == DITHER_AMPLITUDE || dither_setpoint == -DITHER_AMPLITUDE) dither_direction = -dither_direction;
+      }
+    } else {
+      // The faster modes just aim for the midpoint.
+      dither_setpoint = 0;
+      dither_direction = 1;
+      dither_timer = 0;
+    }
+    current_phase_error -= dither_setpoint;
+#endif
+
+#ifdef HANGING_BRIDGE
+    // Watch the QE sequence for a hanging bridge.
+    average_qe_step += (fabs(pps_err - last_pps_err) - average_qe_step) / HB_FILTER;
+    average_qe_size += (fabs(pps_err) - average_qe_size) / HB_SCALE_FILTER;
+    last_pps_err = pps_err;
+    if (!hanging_bridge && average_qe_step < HB_RATIO * average_qe_size) {
+      hanging_bridge = 1;
+      qe_remainder = 0.;
+#ifdef DEBUG
+      tx_pstr(PSTR("HB_ON\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_HB_ON, 0, 0, 0);
+#endif
+    } else if (hanging_bridge && average_qe_step > 2 * HB_RATIO * average_qe_size) {
+      hanging_bridge = 0;
+#ifdef DEBUG
+      tx_pstr(PSTR("HB_OFF\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_HB_OFF, 0, 0, 0);
+#endif
+    }
+#endif
+
     // This is an approximation of a rolling average, but it's good enough
     // for us, because it should not change very much in 1 second.
     unsigned int filter_time = time_constant / 4;
@@ -798,7 +2878,7 @@ void __ATTR_NORETURN__ main() {
     average_pps_error += ((double)intracycle_delta) / ((seconds_delta + 1) * filter_time);
 
 #ifdef DEBUG
-    {
+    if (log_record) {
       char buf[8];
       tx_pstr(PSTR("MOD="));
       itoa(mode, buf, 10);
@@ -810,13 +2890,13 @@ void __ATTR_NORETURN__ main() {
     if (mode == MODE_START) {
       // In the startup mode, we try and convert the average cycle delta
       // into a PPB error
-      double adj_val = (1000000000.0 / F_CPU) * average_pps_error * START_GAIN;
+      double adj_val = (1000000000.0 / F_OSC) * average_pps_error * START_GAIN;
       trim_value -= adj_val;
       unsigned long dac_value = (long)(DAC_SIGN * trim_value) + DAC_MIDPOINT;
 
       writeDacValue(dac_value);
 #ifdef DEBUG
-      {
+      if (log_record) {
         char buf[8];
         tx_pstr(PSTR("SB="));
         ltoa(intracycle_delta, buf, 10);
@@ -848,6 +2928,8 @@ void __ATTR_NORETURN__ main() {
           exit_timer = 0;
 #ifdef DEBUG
           tx_pstr(PSTR("M_FAST\r\n\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_M_FAST, 0, 0, 0);
 #endif
           continue;
         }
@@ -865,6 +2947,8 @@ void __ATTR_NORETURN__ main() {
       dtostrf(average_pps_error, 7, 2, buf);
       tx_str(buf);
       tx_pstr(PSTR("\r\nM_START\r\n\r\n"));
+#elif defined(EVENT_LOG)
+      log_event(EV_M_START, lround(average_pps_error * 100), 0, 0);
 #endif
       reset_pll();
       continue;
@@ -873,13 +2957,20 @@ void __ATTR_NORETURN__ main() {
     // Test for possible upgrade if we're not maxed out
     if (mode != MODE_SLOW) {
 #ifdef DEBUG
-      {
+      if (log_record) {
         char buf[8];
         tx_pstr(PSTR("ET="));
         ltoa(exit_timer, buf, 10);
         tx_str(buf);
         tx_pstr(PSTR("\r\n"));
       }
+#endif
+#ifdef SURVEY
+      // Until the receiver is holding a surveyed position, position noise
+      // leaks into its PPS, so don't go on to the longest time constant.
+      if (mode == MODE_SLOW - 1 && survey_state != SURVEY_HOLD) {
+        exit_timer = 0;
+      } else
 #endif
       if (fabs(average_phase_error) <= 5.0) {
         if (++exit_timer >= 200 * mode * mode) {
@@ -889,24 +2980,47 @@ void __ATTR_NORETURN__ main() {
           // translate the iTerm whenever we change the time constant.
           double ratio = ((double)mode_to_tc(mode))/((double)mode_to_tc(mode - 1));
           iTerm *= ratio;
+#ifdef DRIFT_TERM
+          dTerm *= ratio;
+#endif
 #ifdef DEBUG
           tx_pstr(PSTR("M_UP\r\n\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_M_UP, mode, 0, 0);
 #endif
         }
       } else {
         exit_timer = 0;
       }
     } else if (mode != MODE_FAST) { // Test for possible downgrade
+#ifdef JUMP_DETECT
+      // After a jump, the phase error is expected to be large for a while.
+      if (jump_boost) {
+        if (--jump_boost == 0) {
+          iTerm *= JUMP_BOOST;
+#ifdef DRIFT_TERM
+          dTerm *= JUMP_BOOST;
+#endif
+#ifdef DEBUG
+          tx_pstr(PSTR("JMP_DONE\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_JMP_DONE, 0, 0, 0);
+#endif
+        }
+      } else
+#endif
       if (fabs(average_phase_error) >= 50.0 * mode) {
           downgrade_mode();
           time_constant = mode_to_tc(mode);
 #ifdef DEBUG
           tx_pstr(PSTR("M_DN\r\n\r\n"));
+#elif defined(EVENT_LOG)
+          log_event(EV_M_DN, mode, 0, 0);
 #endif
       }
     }
 #ifdef DEBUG
-    {
+    if (log_record) {
       char buf[8];
       tx_pstr(PSTR("SB="));
       ltoa(intracycle_delta, buf, 10);
@@ -922,13 +3036,94 @@ void __ATTR_NORETURN__ main() {
       dtostrf(average_phase_error, 7, 2, buf);
       tx_str(buf);
       tx_pstr(PSTR("\r\n"));
+#ifdef PHASE_DITHER
+      tx_pstr(PSTR("DTH="));
+      itoa(dither_setpoint, buf, 10);
+      tx_str(buf);
+      tx_pstr(PSTR("\r\n"));
+#endif
+    }
+#endif
+
+#ifdef JUMP_DETECT
+    if (mode != MODE_SLOW || jump_boost || seconds_delta != 0) {
+      // The detector needs an unbroken run of seconds in the slow mode.
+      jump_filled = 0;
+      jump_confirm = 0;
+    } else {
+      if (jump_filled == 0) {
+        jump_phase = 0;
+      } else {
+        // The cycle count says roughly how far the phase moved, and that
+        // tells us how many times the phase detector wrapped.
+        int step = current_phase_error - jump_last_phase;
+        double coarse_step = (1000000000.0 / F_OSC) * intracycle_delta;
+        step += PHASE_WRAP * lround((coarse_step - step) / PHASE_WRAP);
+        jump_phase += step;
+      }
+      jump_last_phase = current_phase_error;
+      long oldest = jump_history[jump_index];
+      jump_history[jump_index] = jump_phase;
+      jump_index = (jump_index + 1) % JUMP_WINDOW;
+      if (jump_filled < JUMP_WINDOW) {
+        jump_filled++;
+      } else {
+        double rate = ((double)(jump_phase - oldest)) / JUMP_WINDOW;
+        if (jump_settle < JUMP_BASELINE) {
+          // Until we have enough, the baseline is a straight average.
+          jump_baseline += (rate - jump_baseline) / ++jump_settle;
+        } else if (fabs(rate - jump_baseline) > JUMP_THRESHOLD) {
+          if (++jump_confirm >= JUMP_CONFIRM) {
+            double jump = rate - jump_baseline;
+            trim_value -= GAIN * jump;
+            if (trim_value > DAC_MIDPOINT) trim_value = DAC_MIDPOINT;
+            if (trim_value < -DAC_MIDPOINT) trim_value = -DAC_MIDPOINT;
+            // Widen the loop for a while. The iTerm is kept in terms of the
+            // time constant, just as for a mode change.
+            jump_boost = JUMP_BOOST_SECONDS;
+            time_constant /= JUMP_BOOST;
+            iTerm /= JUMP_BOOST;
+#ifdef DRIFT_TERM
+            dTerm /= JUMP_BOOST;
+#endif
+            jump_filled = 0;
+            jump_confirm = 0;
+#ifdef DEBUG
+            char buf[8];
+            // JMP = the oscillator frequency jumped by this many ppb.
+            tx_pstr(PSTR("JMP="));
+            dtostrf(jump, 6, 2, buf);
+            tx_str(buf);
+            tx_pstr(PSTR("\r\n"));
+#elif defined(EVENT_LOG)
+            log_event(EV_JMP, lround(jump * 100), 0, 0);
+#endif
+          }
+        } else {
+          jump_confirm = 0;
+          jump_baseline += (rate - jump_baseline) / JUMP_BASELINE;
+        }
+      }
     }
 #endif
 
     double pTerm = average_phase_error * GAIN;
     iTerm += pTerm / (time_constant * DAMPING);
 
+#ifdef DRIFT_TERM
+    // The drift term integrates the iTerm. That's what lets the loop follow a
+    // steady frequency drift with no standing phase error: the iTerm settles
+    // at whatever value makes the drift term ramp at the drift rate.
+    if (mode >= DRIFT_MIN_MODE && fabs(average_phase_error) <= DRIFT_WINDOW) {
+      double drift_step = iTerm / (time_constant * DRIFT_DAMPING);
+      // Don't let it wind up against either end of the DAC, either.
+      if (fabs(trim_value - (pTerm + iTerm + dTerm + drift_step) / time_constant) < DAC_MIDPOINT)
+        dTerm += drift_step;
+    }
+    double adj_val = (pTerm + iTerm + dTerm) / time_constant;
+#else
     double adj_val = (pTerm + iTerm) / time_constant;
+#endif
 
     // For the PLL, the trim_value we calculated during the FLL stays put
     // and the adj_val we've computed will be relative to that.
@@ -944,14 +3139,30 @@ void __ATTR_NORETURN__ main() {
     if (fabs(iTerm) > iTerm_modulo) {
 #ifdef DEBUG
         tx_pstr(PSTR("RED\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_RED, (iTerm < 0) ? 1000 : -1000, 0, 0);
 #endif
 	int sign = (iTerm < 0)?-1:1;
         iTerm -= sign * iTerm_modulo;
         trim_value -= sign * 1000;
     }
+#ifdef DRIFT_TERM
+    // Under steady aging it's the drift term that accumulates, so it
+    // gets off-loaded the same way.
+    if (fabs(dTerm) > iTerm_modulo) {
+#ifdef DEBUG
+        tx_pstr(PSTR("RED\r\n"));
+#elif defined(EVENT_LOG)
+        log_event(EV_RED, (dTerm < 0) ? 1000 : -1000, 1, 0);
+#endif
+        int sign = (dTerm < 0)?-1:1;
+        dTerm -= sign * iTerm_modulo;
+        trim_value -= sign * 1000;
+    }
+#endif
 
 #ifdef DEBUG
-    {
+    if (log_record) {
       char buf[8];
       tx_pstr(PSTR("pT="));
       dtostrf(pTerm, 7, 2, buf);
@@ -959,6 +3170,11 @@ void __ATTR_NORETURN__ main() {
       tx_pstr(PSTR("\r\niT="));
       dtostrf(iTerm, 7, 2, buf);
       tx_str(buf);
+#ifdef DRIFT_TERM
+      tx_pstr(PSTR("\r\ndT="));
+      dtostrf(dTerm, 7, 2, buf);
+      tx_str(buf);
+#endif
       // AV = Adjustment Value - the delta being applied right now to the TP
       tx_pstr(PSTR("\r\nAV="));
       dtostrf(adj_val, 7, 2, buf);
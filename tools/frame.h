@@ -0,0 +1,112 @@
+/*
+
+    Binary frame reading for the GPSDO host tools
+    Copyright (C) 2015 Nicholas W. Sayer
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    
+  */
+
+
+// The firmware's binary frames (see tx_frame() in GPSDO_v4.c) are a sync
+// byte, a type byte, a payload length byte, the payload, then the
+// CRC-CCITT of the type, length and payload, low byte first. Payloads are
+// little-endian, with 16 bit ints.
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define FRAME_SYNC 0xa5
+
+struct frame {
+  unsigned char type;
+  unsigned char len;
+  unsigned char payload[255];
+};
+
+// This is avr-libc's _crc_ccitt_update(), so the two agree bit for bit.
+static inline uint16_t crc_ccitt_update(uint16_t crc, uint8_t data) {
+  data ^= (crc & 0xff);
+  data ^= data << 4;
+  return ((((uint16_t)data << 8) | (crc >> 8)) ^ (uint8_t)(data >> 4) ^ ((uint16_t)data << 3));
+}
+
+// A stream of frames. When a candidate frame turns out to be bad, the
+// bytes after its sync byte are pushed back, so that a good frame hiding
+// in them (after a dropped or damaged byte) isn't lost.
+struct frame_stream {
+  FILE *in;
+  unsigned char back[2 + 255 + 2];
+  int back_len, back_pos;
+};
+
+static inline void frame_stream_init(struct frame_stream *s, FILE *in) {
+  s->in = in;
+  s->back_len = s->back_pos = 0;
+}
+
+static inline int frame_getc(struct frame_stream *s) {
+  if (s->back_pos < s->back_len) return s->back[s->back_pos++];
+  return getc(s->in);
+}
+
+// Read the next good frame from the stream. Anything that isn't one (the
+// text debug log, or frames with a bad CRC) is skipped, and counted in
+// *skipped if it's not NULL. Returns 0 at the end of the stream.
+static inline int read_frame(struct frame_stream *s, struct frame *f, unsigned long *skipped) {
+  int c;
+  while((c = frame_getc(s)) != EOF) {
+    if (c != FRAME_SYNC) {
+      if (skipped != NULL) (*skipped)++;
+      continue;
+    }
+    // Everything after the sync byte, in case it has to go back.
+    unsigned char got[sizeof(s->back)];
+    int n = 0, len = 0;
+    while(n < 2 || n < 2 + len + 2) {
+      if ((c = frame_getc(s)) == EOF) return 0;
+      got[n++] = c;
+      if (n == 2) len = got[1];
+    }
+    uint16_t crc = 0xffff;
+    for(int i = 0; i < 2 + len; i++) crc = crc_ccitt_update(crc, got[i]);
+    if (crc != (got[2 + len] | (got[3 + len] << 8))) {
+      // Not a frame after all (or a damaged one). Skip the sync byte and
+      // look again from the byte after it. What's left of the pushback
+      // goes back in front of what we just took from it.
+      int rest = s->back_len - s->back_pos;
+      memmove(s->back + n, s->back + s->back_pos, rest);
+      memcpy(s->back, got, n);
+      s->back_len = n + rest;
+      s->back_pos = 0;
+      if (skipped != NULL) (*skipped)++;
+      continue;
+    }
+    f->type = got[0];
+    f->len = len;
+    memcpy(f->payload, got + 2, len);
+    return 1;
+  }
+  return 0;
+}
+
+static inline uint16_t get_u16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t get_u32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
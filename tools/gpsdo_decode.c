@@ -0,0 +1,121 @@
+/*
+
+    GPSDO binary log decoder
+    Copyright (C) 2015 Nicholas W. Sayer
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+    
+  */
+
+// Reads the firmware's binary output (events, in MEASURE builds the
+// measurement frames, and in RAW_CAPTURE builds the loop's inputs) from a
+// file or stdin, and prints it as text, one
+// frame per line:
+//
+//   E <pps> <event name> [args...]
+//   M <pps> <utc> <phase 0.1ns> <cycles> <adc> <qe 0.1ns> <seconds>
+//   F <utc> <gate seconds> <freq ppt>
+//   R <pps> <utc> <timestamp> <span> <adc> <qe> <flags> <qe latency> <gsa latency> <rmc latency>
+//
+// An R line's qe is "-" if none came for that PPS. The latencies are in
+// timer counts after the PPS, and 0 for a sentence that hadn't come when
+// the loop took it.
+//
+// usage: gpsdo_decode [file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "frame.h"
+
+static const struct {
+  int id;
+  const char *name;
+  int args;
+} events[] = {
+#include "events.h"
+};
+#define EVENT_COUNT (sizeof(events) / sizeof(events[0]))
+
+static void print_event(const struct frame *f) {
+  if (f->len < 5) return;
+  uint32_t pps = get_u32(f->payload);
+  int id = f->payload[4];
+  const char *name = NULL;
+  for(int i = 0; i < EVENT_COUNT; i++)
+    if (events[i].id == id) name = events[i].name;
+  printf("E %lu ", (unsigned long)pps);
+  if (name != NULL)
+    printf("%s", name);
+  else
+    printf("EV%d", id); // from a newer firmware than this dictionary
+  for(int i = 5; i + 4 <= f->len; i += 4)
+    printf(" %ld", (long)(int32_t)get_u32(f->payload + i));
+  printf("\n");
+}
+
+int main(int argc, char **argv) {
+  FILE *in = stdin;
+  if (argc > 1) {
+    in = fopen(argv[1], "rb");
+    if (in == NULL) {
+      perror(argv[1]);
+      return 1;
+    }
+  }
+
+  struct frame_stream stream;
+  struct frame f;
+  unsigned long skipped = 0;
+  frame_stream_init(&stream, in);
+  while(read_frame(&stream, &f, &skipped)) {
+    switch(f.type) {
+      case 'E':
+        print_event(&f);
+        break;
+      case 'M':
+        if (f.len < 21) break;
+        printf("M %lu %lu %ld %ld %u %d %u\n",
+          (unsigned long)get_u32(f.payload), (unsigned long)get_u32(f.payload + 4),
+          (long)(int32_t)get_u32(f.payload + 8), (long)(int32_t)get_u32(f.payload + 12),
+          get_u16(f.payload + 16), (int16_t)get_u16(f.payload + 18), f.payload[20]);
+        break;
+      case 'F':
+        if (f.len < 10) break;
+        printf("F %lu %u %ld\n", (unsigned long)get_u32(f.payload), get_u16(f.payload + 4),
+          (long)(int32_t)get_u32(f.payload + 6));
+        break;
+      case 'R': {
+        if (f.len < 38) break;
+        char qe[8];
+        memcpy(qe, f.payload + 30, 7);
+        qe[7] = 0;
+        printf("R %lu %lu %lu %lu %u %s %u %lu %lu %lu\n",
+          (unsigned long)get_u32(f.payload), (unsigned long)get_u32(f.payload + 4),
+          (unsigned long)get_u32(f.payload + 8), (unsigned long)get_u32(f.payload + 12),
+          get_u16(f.payload + 28), (f.payload[37] & 2) ? qe : "-", f.payload[37],
+          (unsigned long)get_u32(f.payload + 16), (unsigned long)get_u32(f.payload + 20),
+          (unsigned long)get_u32(f.payload + 24));
+        break;
+      }
+      default:
+        break; // a frame type we don't know about
+    }
+  }
+  if (skipped != 0) fprintf(stderr, "%lu bytes skipped\n", skipped);
+  return 0;
+}
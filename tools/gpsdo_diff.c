@@ -0,0 +1,176 @@
+/*
+
+    GPSDO firmware differential replay
+    Copyright (C) 2015 Nicholas W. Sayer
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+  */
+
+// Runs two simulator builds (see gpsdo_sim.c) - typically the firmware
+// before and after a change - over the same scenarios, several at a
+// time, and prints each scenario's metrics side by side:
+//
+//   <scenario> <metric> <base> <candidate> <change>
+//
+// Lines where the two differ are marked with a '*'. The exit status is
+// 1 if anything differed, and 2 if a run failed.
+//
+// usage: gpsdo_diff [-j jobs] sim_base sim_cand scenario.scn...
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_OUTPUT 1024
+
+struct run {
+  const char *sim;
+  const char *scenario;
+  pid_t pid;
+  int fd;
+  char output[MAX_OUTPUT];
+  size_t len;
+  int status;
+};
+
+static int start_run(struct run *r) {
+  int fds[2];
+  if (pipe(fds)) {
+    perror("pipe");
+    return -1;
+  }
+  r->pid = fork();
+  if (r->pid < 0) {
+    perror("fork");
+    close(fds[0]);
+    close(fds[1]);
+    return -1;
+  }
+  if (r->pid == 0) {
+    close(fds[0]);
+    dup2(fds[1], 1);
+    close(fds[1]);
+    execl(r->sim, r->sim, r->scenario, (char *)NULL);
+    perror(r->sim);
+    _exit(127);
+  }
+  close(fds[1]);
+  r->fd = fds[0];
+  return 0;
+}
+
+// A run only prints its one line at the very end, so it's safe to read
+// it all before waiting for the process.
+static void finish_run(struct run *r) {
+  ssize_t n;
+  while((n = read(r->fd, r->output + r->len, sizeof(r->output) - 1 - r->len)) > 0)
+    r->len += n;
+  r->output[r->len] = 0;
+  close(r->fd);
+  waitpid(r->pid, &r->status, 0);
+}
+
+// Finds "key=" in a run's output. Returns NULL if it isn't there.
+static const char *get_metric(const struct run *r, const char *key) {
+  size_t key_len = strlen(key);
+  for(const char *p = r->output; (p = strstr(p, key)) != NULL; p += key_len) {
+    if ((p == r->output || p[-1] == ' ') && p[key_len] == '=') return p + key_len + 1;
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv) {
+  int jobs = 1;
+  int opt;
+  while((opt = getopt(argc, argv, "j:")) != -1) {
+    switch(opt) {
+      case 'j':
+        jobs = atoi(optarg);
+        if (jobs < 1) jobs = 1;
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-j jobs] sim_base sim_cand scenario.scn...\n", argv[0]);
+        return 2;
+    }
+  }
+  if (argc - optind < 3) {
+    fprintf(stderr, "usage: %s [-j jobs] sim_base sim_cand scenario.scn...\n", argv[0]);
+    return 2;
+  }
+  const char *sims[2] = { argv[optind], argv[optind + 1] };
+  int scenarios = argc - optind - 2;
+  int run_count = scenarios * 2;
+  struct run *runs = calloc(run_count, sizeof(*runs));
+  if (runs == NULL) {
+    perror("calloc");
+    return 2;
+  }
+  for(int i = 0; i < run_count; i++) {
+    runs[i].sim = sims[i & 1];
+    runs[i].scenario = argv[optind + 2 + i / 2];
+  }
+
+  // Keep up to jobs runs going, finishing them in the order they started.
+  int started = 0, finished = 0;
+  while(finished < run_count) {
+    while(started < run_count && started - finished < jobs) {
+      if (start_run(&runs[started])) return 2;
+      started++;
+    }
+    finish_run(&runs[finished++]);
+  }
+
+  static const char *metrics[] = { "fast_s", "settle_s", "mean_ns", "rms_ns", "max_ns", "adev1", "adev10", "adev100", "adev1000",
+    "dac_moves_hr", "dac_step", "mode_changes", "overruns" };
+  int differed = 0, failed = 0;
+  for(int i = 0; i < run_count; i += 2) {
+    struct run *base = &runs[i], *cand = &runs[i + 1];
+    const char *name = get_metric(base, "scenario");
+    if (name == NULL) name = base->scenario;
+    int name_len = strcspn(name, " \n");
+    for(int j = 0; j < 2; j++) {
+      struct run *r = &runs[i + j];
+      if (!WIFEXITED(r->status) || WEXITSTATUS(r->status) != 0) {
+        fprintf(stderr, "%s %s: failed\n", r->sim, r->scenario);
+        failed = 1;
+      }
+    }
+    for(int j = 0; j < sizeof(metrics) / sizeof(metrics[0]); j++) {
+      const char *b = get_metric(base, metrics[j]), *c = get_metric(cand, metrics[j]);
+      if (b == NULL || c == NULL) continue;
+      char *b_end, *c_end;
+      double bv = strtod(b, &b_end), cv = strtod(c, &c_end);
+      int b_len = strcspn(b, " \n"), c_len = strcspn(c, " \n");
+      int same = (b_len == c_len && !strncmp(b, c, b_len));
+      if (!same) differed = 1;
+      printf("%c %-16.*s %-12s %12.*s %12.*s", same ? ' ' : '*', name_len, name, metrics[j], b_len, b, c_len, c);
+      // The change is relative, except where the base is zero, or
+      // where the metric is in seconds and -1 means never. There's no
+      // change to give if either side is n/a.
+      if (same || b_end == b || c_end == c)
+        printf("\n");
+      else if (bv > 0 && cv >= 0)
+        printf(" %+9.1f%%\n", 100 * (cv - bv) / bv);
+      else
+        printf(" %+10g\n", cv - bv);
+    }
+  }
+  if (failed) return 2;
+  return differed;
+}
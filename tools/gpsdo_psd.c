@@ -0,0 +1,417 @@
+/*
+
+    GPSDO phase noise spectrum and noise type tool
+    Copyright (C) 2015 Nicholas W. Sayer
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+  */
+
+// Works out what kind of noise an oscillator (or a whole GPSDO) has, from
+// a 1 Hz phase record. It takes Welch power spectral densities of the
+// phase residual (after taking out the frequency offset) and of the
+// fractional frequency, then fits the frequency PSD with the usual sum
+// of power laws:
+//
+//   S_y(f) = h2 f^2 + h1 f + h0 + h-1 / f + h-2 / f^2
+//
+// which are white PM (the phase detector and the receiver), flicker PM,
+// white FM, flicker FM (most OCXOs, at longer taus) and random walk FM
+// (temperature, aging). It prints the spectra in log-spaced bands, with
+// the local slope and which term dominates, then the fitted h values and
+// the frequencies where one term takes over from the next. A loop's time
+// constant is best set near where the oscillator's noise crosses over
+// the reference's.
+//
+// The input is a MEASURE capture (the M frames of a free running
+// oscillator against GPS), or with -t, a text file of phase values in ns,
+// one per line, one per second (e.g. the CPE= values from a DEBUG log,
+// for the residual of a locked loop).
+//
+// usage: gpsdo_psd [-t] [-n segment length] [-j threads] [file]
+//
+// The segment length is a power of two (default 4096). Longer segments
+// reach lower frequencies, but there are fewer of them to average. The
+// segments are spread over the threads.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "frame.h"
+
+#define PI 3.14159265358979323846
+#define BANDS_PER_DECADE 5
+#define TERMS 5
+
+static const struct {
+  int alpha;
+  const char *name;
+} terms[TERMS] = {
+  { 2, "WPM" },
+  { 1, "FPM" },
+  { 0, "WFM" },
+  { -1, "FFM" },
+  { -2, "RWFM" },
+};
+
+// The data, in seconds, with a sample every second.
+static double *phase;
+static double *freq;
+static long count;
+
+static int seg_len = 4096;
+static int threads = 1;
+
+struct welch_job {
+  const double *data;
+  long data_len;
+  long first, step; // the segments this thread does
+  double *psd; // seg_len / 2 + 1 bins, summed over its segments
+  long segments;
+};
+
+// An in-place radix-2 FFT. n is a power of two.
+static void fft(double *re, double *im, int n) {
+  for(int i = 1, j = 0; i < n; i++) {
+    int bit = n >> 1;
+    for(; j & bit; bit >>= 1) j ^= bit;
+    j ^= bit;
+    if (i < j) {
+      double t = re[i]; re[i] = re[j]; re[j] = t;
+      t = im[i]; im[i] = im[j]; im[j] = t;
+    }
+  }
+  for(int len = 2; len <= n; len <<= 1) {
+    double ang = -2 * PI / len;
+    double wr = cos(ang), wi = sin(ang);
+    for(int i = 0; i < n; i += len) {
+      double cr = 1, ci = 0;
+      for(int j = 0; j < len / 2; j++) {
+        double ur = re[i + j], ui = im[i + j];
+        double vr = re[i + j + len / 2] * cr - im[i + j + len / 2] * ci;
+        double vi = re[i + j + len / 2] * ci + im[i + j + len / 2] * cr;
+        re[i + j] = ur + vr;
+        im[i + j] = ui + vi;
+        re[i + j + len / 2] = ur - vr;
+        im[i + j + len / 2] = ui - vi;
+        double t = cr * wr - ci * wi;
+        ci = cr * wi + ci * wr;
+        cr = t;
+      }
+    }
+  }
+}
+
+// Hann windowed, half overlapped segments, each with its mean taken out.
+static void *welch_thread(void *arg) {
+  struct welch_job *job = arg;
+  int n = seg_len;
+  double *re = malloc(n * sizeof(double)), *im = malloc(n * sizeof(double)), *window = malloc(n * sizeof(double));
+  if (re == NULL || im == NULL || window == NULL) {
+    perror("malloc");
+    exit(1);
+  }
+  double wsum = 0;
+  for(int i = 0; i < n; i++) {
+    window[i] = 0.5 - 0.5 * cos(2 * PI * i / n);
+    wsum += window[i] * window[i];
+  }
+  long segments = (job->data_len - n) / (n / 2) + 1;
+  for(long s = job->first; s < segments; s += job->step) {
+    const double *d = job->data + s * (n / 2);
+    double mean = 0;
+    for(int i = 0; i < n; i++) mean += d[i];
+    mean /= n;
+    for(int i = 0; i < n; i++) {
+      re[i] = (d[i] - mean) * window[i];
+      im[i] = 0;
+    }
+    fft(re, im, n);
+    // One sided, at a 1 Hz sample rate.
+    for(int k = 0; k <= n / 2; k++) {
+      double p = (re[k] * re[k] + im[k] * im[k]) / wsum;
+      if (k != 0 && k != n / 2) p *= 2;
+      job->psd[k] += p;
+    }
+    job->segments++;
+  }
+  free(re);
+  free(im);
+  free(window);
+  return NULL;
+}
+
+// The Welch PSD of data, into psd (seg_len / 2 + 1 bins).
+static void welch(const double *data, long len, double *psd) {
+  pthread_t *ids = calloc(threads, sizeof(*ids));
+  struct welch_job *jobs = calloc(threads, sizeof(*jobs));
+  if (ids == NULL || jobs == NULL) {
+    perror("calloc");
+    exit(1);
+  }
+  for(int t = 0; t < threads; t++) {
+    jobs[t].data = data;
+    jobs[t].data_len = len;
+    jobs[t].first = t;
+    jobs[t].step = threads;
+    jobs[t].psd = calloc(seg_len / 2 + 1, sizeof(double));
+    if (jobs[t].psd == NULL) {
+      perror("calloc");
+      exit(1);
+    }
+    if (pthread_create(&ids[t], NULL, welch_thread, &jobs[t])) {
+      perror("pthread_create");
+      exit(1);
+    }
+  }
+  long segments = 0;
+  memset(psd, 0, (seg_len / 2 + 1) * sizeof(double));
+  for(int t = 0; t < threads; t++) {
+    pthread_join(ids[t], NULL);
+    for(int k = 0; k <= seg_len / 2; k++) psd[k] += jobs[t].psd[k];
+    segments += jobs[t].segments;
+    free(jobs[t].psd);
+  }
+  for(int k = 0; k <= seg_len / 2; k++) psd[k] /= segments;
+  free(ids);
+  free(jobs);
+}
+
+// Least squares for the h values, fitted to the bands in relative terms
+// (so every band counts the same, however small it is), and kept
+// non-negative by coordinate descent.
+static void fit_terms(const double *f, const double *sy, int bands, double *h) {
+  double a[TERMS][64], scale[TERMS];
+  for(int j = 0; j < TERMS; j++) {
+    double norm = 0;
+    for(int i = 0; i < bands; i++) {
+      a[j][i] = pow(f[i], terms[j].alpha) / sy[i];
+      norm += a[j][i] * a[j][i];
+    }
+    scale[j] = sqrt(norm);
+    for(int i = 0; i < bands; i++) a[j][i] /= scale[j];
+    h[j] = 0;
+  }
+  double resid[64];
+  for(int i = 0; i < bands; i++) resid[i] = 1; // the target, less the fit so far
+  for(int iter = 0; iter < 20000; iter++) {
+    double moved = 0;
+    for(int j = 0; j < TERMS; j++) {
+      double dot = 0;
+      for(int i = 0; i < bands; i++) dot += a[j][i] * resid[i];
+      double next = h[j] + dot; // the columns are unit length
+      if (next < 0) next = 0;
+      double delta = next - h[j];
+      if (delta == 0) continue;
+      for(int i = 0; i < bands; i++) resid[i] -= delta * a[j][i];
+      h[j] = next;
+      moved += fabs(delta);
+    }
+    if (moved < 1e-12) break;
+  }
+  for(int j = 0; j < TERMS; j++) h[j] /= scale[j];
+}
+
+// Which term of the fit is the biggest at f.
+static int dominant(const double *h, double f) {
+  int best = 0;
+  for(int j = 1; j < TERMS; j++)
+    if (h[j] * pow(f, terms[j].alpha) > h[best] * pow(f, terms[best].alpha)) best = j;
+  return best;
+}
+
+static int read_capture(FILE *in) {
+  struct frame_stream stream;
+  struct frame fr;
+  long size = 0;
+  int started = 0;
+  int32_t last_raw = 0;
+  double unwrapped = 0;
+  frame_stream_init(&stream, in);
+  while(read_frame(&stream, &fr, NULL)) {
+    if (fr.type != 'M' || fr.len < 21) continue;
+    int32_t raw = (int32_t)get_u32(fr.payload + 8);
+    int seconds = fr.payload[20];
+    if (!started) {
+      started = 1;
+      seconds = 1;
+    } else {
+      unwrapped += (int32_t)((uint32_t)raw - (uint32_t)last_raw); // it wraps at 32 bits
+    }
+    last_raw = raw;
+    if (seconds < 1) seconds = 1;
+    // Missed seconds are filled in along a straight line.
+    for(int s = seconds - 1; s >= 0; s--) {
+      if (count == size) {
+        size = size ? size * 2 : 65536;
+        phase = realloc(phase, size * sizeof(double));
+        if (phase == NULL) {
+          perror("realloc");
+          exit(1);
+        }
+      }
+      double prev = count ? phase[count - 1] : unwrapped * 1e-10;
+      phase[count] = unwrapped * 1e-10 - (unwrapped * 1e-10 - prev) * s / seconds;
+      count++;
+    }
+  }
+  return 0;
+}
+
+static int read_text(FILE *in) {
+  long size = 0;
+  char line[128];
+  while(fgets(line, sizeof(line), in) != NULL) {
+    char *end;
+    double v = strtod(line, &end);
+    if (end == line) continue;
+    if (count == size) {
+      size = size ? size * 2 : 65536;
+      phase = realloc(phase, size * sizeof(double));
+      if (phase == NULL) {
+        perror("realloc");
+        exit(1);
+      }
+    }
+    phase[count++] = v * 1e-9;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int text = 0;
+  int i;
+  for(i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != 0; i++) {
+    if (!strcmp(argv[i], "-t")) {
+      text = 1;
+    } else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+      seg_len = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "-j") && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else {
+      i = argc + 1;
+    }
+  }
+  if (i > argc || i < argc - 1 || seg_len < 16 || (seg_len & (seg_len - 1)) || threads < 1) {
+    fprintf(stderr, "usage: %s [-t] [-n segment length] [-j threads] [file]\n", argv[0]);
+    return 2;
+  }
+  FILE *in = stdin;
+  if (i < argc) {
+    in = fopen(argv[i], text ? "r" : "rb");
+    if (in == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+  }
+  if (text)
+    read_text(in);
+  else
+    read_capture(in);
+  if (count < seg_len + 1) {
+    fprintf(stderr, "%ld samples is less than one segment (%d)\n", count, seg_len);
+    return 1;
+  }
+
+  // Take the frequency offset out of the phase, with a least squares line.
+  double sx = 0, sxx = 0, sy = 0, sxy = 0;
+  for(long n = 0; n < count; n++) {
+    sx += n;
+    sxx += (double)n * n;
+    sy += phase[n];
+    sxy += n * phase[n];
+  }
+  double slope = (count * sxy - sx * sy) / (count * sxx - sx * sx);
+  double offset = (sy - slope * sx) / count;
+  freq = malloc((count - 1) * sizeof(double));
+  if (freq == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  for(long n = 0; n < count; n++) phase[n] -= offset + slope * n;
+  for(long n = 0; n < count - 1; n++) freq[n] = phase[n + 1] - phase[n];
+
+  int bins = seg_len / 2 + 1;
+  double *psd_x = malloc(bins * sizeof(double)), *psd_y = malloc(bins * sizeof(double));
+  if (psd_x == NULL || psd_y == NULL) {
+    perror("malloc");
+    return 1;
+  }
+  welch(phase, count, psd_x);
+  welch(freq, count - 1, psd_y);
+  // A first difference isn't quite a derivative. Its response is
+  // 4 sin^2(pi f) rather than (2 pi f)^2, which is low by up to 2.5 times
+  // near Nyquist and would bend a white PM slope down. Take it back out.
+  for(int k = 1; k < bins; k++) {
+    double x = PI * k / seg_len;
+    double sinc = sin(x) / x;
+    psd_y[k] /= sinc * sinc;
+  }
+
+  // Average the bins into log-spaced bands, from the lowest frequency
+  // (skipping the DC bin) up to Nyquist.
+  double band_f[64], band_x[64], band_y[64];
+  int bands = 0;
+  double f_lo = 1.0 / seg_len;
+  double edge = f_lo;
+  int k = 1;
+  while(k < bins && bands < 64) {
+    double next_edge = edge * pow(10, 1.0 / BANDS_PER_DECADE);
+    double fx = 0, px = 0, py = 0;
+    int n = 0;
+    for(; k < bins && (double)k / seg_len < next_edge; k++, n++) {
+      fx += log((double)k / seg_len);
+      px += psd_x[k];
+      py += psd_y[k];
+    }
+    edge = next_edge;
+    if (n == 0) continue;
+    band_f[bands] = exp(fx / n);
+    band_x[bands] = px / n;
+    band_y[bands] = py / n;
+    bands++;
+  }
+
+  double h[TERMS];
+  fit_terms(band_f, band_y, bands, h);
+
+  printf("# %ld seconds, frequency offset %.4g, %d point segments\n", count, slope, seg_len);
+  printf("# f (Hz)      S_x (s^2/Hz)   S_y (1/Hz)     slope  dominant\n");
+  for(int b = 0; b < bands; b++) {
+    int lo = b > 0 ? b - 1 : b, hi = b < bands - 1 ? b + 1 : b;
+    double local = log(band_y[hi] / band_y[lo]) / log(band_f[hi] / band_f[lo]);
+    printf("%-13.4g %-14.4g %-14.4g %6.2f  %s\n", band_f[b], band_x[b], band_y[b], local, terms[dominant(h, band_f[b])].name);
+  }
+  printf("#");
+  for(int j = 0; j < TERMS; j++) printf(" h%d=%.4g", terms[j].alpha, h[j]);
+  printf("\n");
+
+  // Walk down in frequency, noting where each term in the fit gives way
+  // to the next one to dominate.
+  int prev = -1;
+  for(int b = bands - 1; b >= 0; b--) {
+    int best = dominant(h, band_f[b]);
+    if (prev >= 0 && best != prev) {
+      double fc = pow(h[best] / h[prev], 1.0 / (terms[prev].alpha - terms[best].alpha));
+      printf("# %s -> %s at %.4g Hz (tau ~ %.4g s)\n", terms[prev].name, terms[best].name, fc, 1 / (2 * PI * fc));
+    }
+    prev = best;
+  }
+  return 0;
+}
@@ -0,0 +1,282 @@
+/*
+
+    GPSDO log rollups
+    Copyright (C) 2015 Nicholas W. Sayer
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+  */
+
+// Reads the firmware's DEBUG log (from a file or stdin) and keeps
+// downsampled archives of it, so that looking at months of trim value
+// aging or mode residency doesn't mean going through every 1 Hz record.
+// There are three tiers - 1 minute, 1 hour and 1 day - each appended to
+// its own file in the archive directory (rollup_1m.txt, rollup_1h.txt
+// and rollup_1d.txt), one line per field per bucket:
+//
+//   <bucket start UTC> <field> <count> <min> <max> <mean> <variance>
+//
+// Only records with a TS= (UTC) line can be placed, so records from
+// before the receiver has told us the time are skipped, as are any
+// that go back in time.
+//
+// The buckets are built up as the data arrives: each record goes into
+// the current minute, each finished minute is merged into the current
+// hour, and each finished hour into the current day. The buckets still
+// open when the input ends are kept in rollup.state in the archive
+// directory, so feeding it one day's log at a time (or a never-ending
+// stream) comes out the same as feeding it everything at once, as long
+// as no record is split between two pieces.
+//
+// usage: gpsdo_rollup [-d archive dir] [-f field,field,...] [log]
+//
+// The default fields are MOD, APE, TV, iT, PD and QE. Any KEY=number
+// log item can be used (DAC's hex is fine too).
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define MAX_FIELDS 16
+#define TIERS 3
+
+static const struct {
+  const char *name;
+  unsigned long seconds;
+} tiers[TIERS] = {
+  { "1m", 60 },
+  { "1h", 3600 },
+  { "1d", 86400 },
+};
+
+// A running summary of one field, built with Welford's method so the
+// variance stays accurate however many samples go into it.
+struct summary {
+  unsigned long n;
+  double min, max, mean, m2;
+};
+
+static void stat_add(struct summary *s, double x) {
+  if (s->n == 0 || x < s->min) s->min = x;
+  if (s->n == 0 || x > s->max) s->max = x;
+  s->n++;
+  double delta = x - s->mean;
+  s->mean += delta / s->n;
+  s->m2 += delta * (x - s->mean);
+}
+
+// Fold one summary into another (Chan et al.'s parallel form of the above).
+static void stat_merge(struct summary *into, const struct summary *from) {
+  if (from->n == 0) return;
+  if (into->n == 0) {
+    *into = *from;
+    return;
+  }
+  if (from->min < into->min) into->min = from->min;
+  if (from->max > into->max) into->max = from->max;
+  unsigned long n = into->n + from->n;
+  double delta = from->mean - into->mean;
+  into->mean += delta * from->n / n;
+  into->m2 += from->m2 + delta * delta * ((double)into->n * from->n / n);
+  into->n = n;
+}
+
+static char *fields[MAX_FIELDS];
+static int field_count;
+static const char *dir = ".";
+
+// The bucket that's open in each tier. A start of 0 means none is.
+static struct {
+  unsigned long start;
+  struct summary stats[MAX_FIELDS];
+} buckets[TIERS];
+
+static unsigned long last_utc;
+static unsigned long skipped;
+
+static FILE *open_in_dir(const char *name, const char *mode) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  return fopen(path, mode);
+}
+
+static void write_bucket(int tier) {
+  char name[32];
+  snprintf(name, sizeof(name), "rollup_%s.txt", tiers[tier].name);
+  FILE *f = open_in_dir(name, "a");
+  if (f == NULL) {
+    perror(name);
+    exit(1);
+  }
+  for(int i = 0; i < field_count; i++) {
+    struct summary *s = &(buckets[tier].stats[i]);
+    if (s->n == 0) continue;
+    fprintf(f, "%lu %s %lu %.9g %.9g %.9g %.9g\n", buckets[tier].start, fields[i], s->n, s->min, s->max, s->mean,
+      s->n > 1 ? s->m2 / (s->n - 1) : 0.0);
+  }
+  fclose(f);
+}
+
+// Close out the tier's bucket if utc is past it, passing it up to the
+// next tier, and open the one utc belongs in.
+static void roll(int tier, unsigned long utc) {
+  unsigned long start = utc - utc % tiers[tier].seconds;
+  if (buckets[tier].start == start) return;
+  if (buckets[tier].start != 0) {
+    write_bucket(tier);
+    if (tier + 1 < TIERS) {
+      // The next tier has to be on the right bucket before this one goes in.
+      roll(tier + 1, buckets[tier].start);
+      for(int i = 0; i < field_count; i++)
+        stat_merge(&(buckets[tier + 1].stats[i]), &(buckets[tier].stats[i]));
+    }
+  }
+  buckets[tier].start = start;
+  memset(buckets[tier].stats, 0, sizeof(buckets[tier].stats));
+}
+
+static void add_record(unsigned long utc, const double *values, const unsigned char *present) {
+  if (utc <= last_utc) {
+    skipped++;
+    return;
+  }
+  last_utc = utc;
+  // The longer buckets are written when the first minute after them
+  // is passed up, so they lag behind the minutes by a minute.
+  roll(0, utc);
+  for(int i = 0; i < field_count; i++)
+    if (present[i]) stat_add(&(buckets[0].stats[i]), values[i]);
+}
+
+// The state file holds the open buckets, so that the next run can
+// carry on with them.
+static void load_state(void) {
+  FILE *f = open_in_dir("rollup.state", "r");
+  if (f == NULL) return; // a new archive
+  char line[256];
+  while(fgets(line, sizeof(line), f) != NULL) {
+    char name[32], field[32];
+    unsigned long start;
+    struct summary s;
+    if (sscanf(line, "last %lu", &last_utc) == 1) continue;
+    if (sscanf(line, "%31s %lu %31s %lu %lf %lf %lf %lf", name, &start, field, &s.n, &s.min, &s.max, &s.mean, &s.m2) != 8) {
+      fprintf(stderr, "rollup.state: bad line: %s", line);
+      exit(1);
+    }
+    for(int tier = 0; tier < TIERS; tier++) {
+      if (strcmp(name, tiers[tier].name)) continue;
+      buckets[tier].start = start;
+      for(int i = 0; i < field_count; i++)
+        if (!strcmp(field, fields[i])) buckets[tier].stats[i] = s;
+    }
+  }
+  fclose(f);
+}
+
+static void save_state(void) {
+  FILE *f = open_in_dir("rollup.state.new", "w");
+  if (f == NULL) {
+    perror("rollup.state.new");
+    exit(1);
+  }
+  fprintf(f, "last %lu\n", last_utc);
+  for(int tier = 0; tier < TIERS; tier++) {
+    if (buckets[tier].start == 0) continue;
+    for(int i = 0; i < field_count; i++) {
+      struct summary *s = &(buckets[tier].stats[i]);
+      fprintf(f, "%s %lu %s %lu %.17g %.17g %.17g %.17g\n", tiers[tier].name, buckets[tier].start, fields[i], s->n, s->min, s->max, s->mean, s->m2);
+    }
+  }
+  if (fclose(f)) {
+    perror("rollup.state.new");
+    exit(1);
+  }
+  char from[1024], to[1024];
+  snprintf(from, sizeof(from), "%s/rollup.state.new", dir);
+  snprintf(to, sizeof(to), "%s/rollup.state", dir);
+  if (rename(from, to)) {
+    perror(to);
+    exit(1);
+  }
+}
+
+static void set_fields(char *list) {
+  field_count = 0;
+  for(char *p = strtok(list, ","); p != NULL; p = strtok(NULL, ",")) {
+    if (field_count == MAX_FIELDS) {
+      fprintf(stderr, "at most %d fields\n", MAX_FIELDS);
+      exit(2);
+    }
+    fields[field_count++] = p;
+  }
+}
+
+int main(int argc, char **argv) {
+  static char default_fields[] = "MOD,APE,TV,iT,PD,QE";
+  set_fields(default_fields);
+
+  int i;
+  for(i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != 0; i++) {
+    if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+      dir = argv[++i];
+    } else if (!strcmp(argv[i], "-f") && i + 1 < argc) {
+      set_fields(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [-d archive dir] [-f field,field,...] [log]\n", argv[0]);
+      return 2;
+    }
+  }
+  FILE *in = stdin;
+  if (i < argc) {
+    in = fopen(argv[i], "r");
+    if (in == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+  }
+  load_state();
+
+  // A record runs from one TS= line to the next.
+  char line[256];
+  unsigned long utc = 0;
+  double values[MAX_FIELDS];
+  unsigned char present[MAX_FIELDS];
+  memset(present, 0, sizeof(present));
+  while(fgets(line, sizeof(line), in) != NULL) {
+    char *eq = strchr(line, '=');
+    if (eq == NULL) continue;
+    *eq = 0;
+    char *value = eq + 1, *end;
+    if (!strcmp(line, "TS")) {
+      if (utc != 0) add_record(utc, values, present);
+      utc = strtoul(value, &end, 10);
+      memset(present, 0, sizeof(present));
+      continue;
+    }
+    if (utc == 0) continue;
+    for(int j = 0; j < field_count; j++) {
+      if (strcmp(line, fields[j])) continue;
+      double v = strtod(value, &end);
+      if (end == value || !isfinite(v)) break;
+      values[j] = v;
+      present[j] = 1;
+    }
+  }
+  if (utc != 0) add_record(utc, values, present);
+  save_state();
+  if (skipped) fprintf(stderr, "%lu records out of order, skipped\n", skipped);
+  return 0;
+}
@@ -0,0 +1,741 @@
+/*
+
+    GPSDO firmware simulator
+    Copyright (C) 2015 Nicholas W. Sayer
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+  */
+
+// Runs the real firmware (GPSDO_v4.c, built for the host against the
+// headers in sim/) against a model of an oscillator and a GPS receiver,
+// for the length of a scenario, then prints a line of metrics:
+//
+//   scenario=<name> fast_s=.. settle_s=.. mean_ns=.. rms_ns=.. max_ns=.. adev1=..
+//   adev10=.. adev100=.. adev1000=.. dac_moves_hr=.. dac_step=..
+//   mode_changes=.. overruns=..
+//
+// fast_s is when the loop first left the FLL, and settle_s is when the
+// phase (modulo the phase detector's range, which is all the firmware
+// can see) last came inside lock_ns and stayed there (-1 for never). The
+// phase and DAC figures cover the metric window, which is the second
+// half of the run unless the scenario says otherwise. The ADEVs are of
+// the oscillator, as the simulator sees it, not as the firmware does.
+// A figure that needs something an older firmware doesn't have (its
+// mode, or its overrun count) is given as n/a.
+//
+// The firmware pets the watchdog once per pass of its main loop, and
+// that's where the simulator takes over: each call moves time forward
+// to the next thing that happens (a PPS, or a sentence from the
+// receiver), delivers it through the ISRs, and returns. Everything is
+// deterministic for a given scenario and seed.
+//
+// On the host, ints are 32 bits and longs 64, so timer_hibits never
+// wraps here. Nothing in the firmware depends on it wrapping.
+//
+// usage: gpsdo_sim [-v] scenario.scn
+//        gpsdo_sim -r capture [scenario.scn]
+//
+// -v copies the firmware's serial output to stderr.
+//
+// -r replays a capture from a RAW_CAPTURE build (its 'R' frames) in place
+// of the model, and copies the firmware's output to stdout instead of
+// printing metrics. Each capture and phase detector reading is delivered
+// as recorded, along with the receiver's lock state, its QE (as the text
+// it sent) and the time, each in a sentence as long after the PPS as the
+// receiver's came, so the loop sees exactly what it saw in service. Seconds without a PPS stay empty.
+// The scenario is optional, for f_hz and baud (which defaults to 115200
+// here, so that the debug log isn't cut back). On the AVR, doubles are
+// 32 bits, so the loop's own arithmetic is only as close as that.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+
+#include "avr/io.h"
+#include "frame.h"
+
+// The registers.
+#define SIM_DEFINE(n) volatile uint8_t n;
+#define SIM_DEFINE16(n) volatile uint16_t n;
+SIM_REGS8(SIM_DEFINE)
+SIM_REGS16(SIM_DEFINE16)
+volatile uintptr_t SP;
+
+// The parts of the firmware we reach into. They're weak, so that an older
+// firmware that lacks one still links. The simulator can't run without
+// the first two, and checks for them at startup.
+extern volatile unsigned int timer_hibits __attribute__((weak));
+extern unsigned long last_dac_value __attribute__((weak));
+extern volatile unsigned int pps_overruns __attribute__((weak));
+extern unsigned char mode __attribute__((weak));
+void TIMER1_CAPT_vect(void);
+void USART0_RX_vect(void);
+void USART0_UDRE_vect(void);
+void firmware_main(void) __attribute__((noreturn));
+
+// The scenario. Frequencies are in ppb, times in seconds and phases in ns.
+static struct {
+  char name[64];
+  double duration;
+  unsigned long seed;
+  double f_hz; // the oscillator's nominal frequency
+  double baud; // the serial port, for pacing the firmware's output
+  int dac_bits;
+  double dac_ppb; // tuning, per DAC step
+  double offset; // frequency error with the DAC at midpoint
+  double aging; // per day
+  double rw; // random walk FM, per root second
+  double warmup, warmup_tau; // a decaying frequency error from turn on
+  double step_time, step; // a frequency jump
+  double phase_step_time, phase_step; // a phase jump, in ns
+  double phase0; // where the phase starts
+  double wpm; // white phase noise on the PPS
+  double pps_width; // the PPS pulse's width
+  double glitch_rate, glitch_width; // spurious pulses on the PPS line: the chance of one each second, and their width in ns
+  double adc_noise; // in ADC counts
+  double adc_dnl; // the spread of each code's fixed error, in ADC counts
+  double saw_period, saw_drift; // the receiver clock's period and its drift, per second
+  double qe_scale; // the receiver's QE is the sawtooth divided by this
+  double psti_time; // when the $PSTI starts, after the PPS. Late enough, and it runs into the next second.
+  double psti_drop; // the chance each second that the $PSTI is lost
+  double outage_start, outage_len; // no fix and no PPS
+  double metric_start; // -1 for the second half
+  double lock_ns;
+} scn = {
+  .duration = 86400, .seed = 1, .f_hz = 10e6, .baud = 9600,
+  .dac_bits = 18, .dac_ppb = 1.0 / 267, .offset = 50, .rw = 0.001,
+  .phase0 = 123, .wpm = 2, .pps_width = 0.1, .glitch_width = 1000, .adc_noise = 1, .saw_period = 20, .saw_drift = 3.7,
+  .qe_scale = 1.5, .psti_time = 0.15, .metric_start = -1, .lock_ns = 50,
+};
+
+static const struct {
+  const char *key;
+  double *val;
+} scn_keys[] = {
+  { "duration", &scn.duration }, { "f_hz", &scn.f_hz }, { "baud", &scn.baud },
+  { "dac_ppb", &scn.dac_ppb }, { "offset", &scn.offset }, { "aging", &scn.aging },
+  { "rw", &scn.rw }, { "warmup", &scn.warmup }, { "warmup_tau", &scn.warmup_tau },
+  { "step_time", &scn.step_time }, { "step", &scn.step }, { "phase0", &scn.phase0 },
+  { "phase_step_time", &scn.phase_step_time }, { "phase_step", &scn.phase_step },
+  { "wpm", &scn.wpm }, { "adc_noise", &scn.adc_noise }, { "adc_dnl", &scn.adc_dnl }, { "saw_period", &scn.saw_period },
+  { "pps_width", &scn.pps_width }, { "glitch_rate", &scn.glitch_rate }, { "glitch_width", &scn.glitch_width },
+  { "saw_drift", &scn.saw_drift }, { "qe_scale", &scn.qe_scale }, { "psti_time", &scn.psti_time }, { "psti_drop", &scn.psti_drop },
+  { "outage_start", &scn.outage_start }, { "outage_len", &scn.outage_len },
+  { "metric_start", &scn.metric_start }, { "lock_ns", &scn.lock_ns },
+};
+
+static FILE *echo; // where the firmware's output goes, if anywhere
+
+// avr-libc's conversions, which the firmware uses for its logging.
+static char *sim_ultoa(unsigned long val, char *buf, int radix, int neg) {
+  char tmp[72], *p = tmp;
+  do {
+    *p++ = "0123456789abcdefghijklmnopqrstuvwxyz"[val % radix];
+    val /= radix;
+  } while(val != 0);
+  char *out = buf;
+  if (neg) *out++ = '-';
+  while(p != tmp) *out++ = *--p;
+  *out = 0;
+  return buf;
+}
+
+char *ultoa(unsigned long val, char *buf, int radix) {
+  return sim_ultoa(val, buf, radix, 0);
+}
+
+char *ltoa(long val, char *buf, int radix) {
+  // avr-libc only signs base 10.
+  if (radix == 10 && val < 0) return sim_ultoa(-(unsigned long)val, buf, radix, 1);
+  return sim_ultoa((unsigned long)val, buf, radix, 0);
+}
+
+char *utoa(unsigned int val, char *buf, int radix) {
+  return sim_ultoa(val, buf, radix, 0);
+}
+
+char *itoa(int val, char *buf, int radix) {
+  if (radix == 10 && val < 0) return sim_ultoa(-(unsigned long)val, buf, radix, 1);
+  return sim_ultoa((unsigned int)val, buf, radix, 0);
+}
+
+char *dtostrf(double val, signed char width, unsigned char prec, char *buf) {
+  sprintf(buf, "%*.*f", width, prec, val);
+  return buf;
+}
+
+// xorshift64*, and Box-Muller on top of it.
+static uint64_t rng_state;
+
+static double rng_uniform(void) {
+  rng_state ^= rng_state >> 12;
+  rng_state ^= rng_state << 25;
+  rng_state ^= rng_state >> 27;
+  return ((rng_state * 2685821657736338717ULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double rng_gauss(void) {
+  double u = rng_uniform();
+  if (u < 1e-300) u = 1e-300;
+  return sqrt(-2 * log(u)) * cos(2 * 3.14159265358979323846 * rng_uniform());
+}
+
+// The state of the world. sim_x is the oscillator's phase against GPS
+// time as of the last whole second, and sim_y its frequency since then.
+static double sim_time;
+static long sim_second;
+static double sim_x, sim_y, sim_rw;
+static double tx_budget;
+
+// The history, one entry per second.
+static double *hist_x;
+static unsigned long *hist_dac;
+static unsigned char *hist_mode;
+
+static uint8_t adcsra;
+static uint16_t adc_phase;
+static double adc_error[1024]; // each code's differential nonlinearity
+static int capturing; // in the capture ISR
+static int64_t adc_fall = -1; // the Timer1 count when the pulse ends, if that's during the capture ISR's conversion
+
+// The replay. replay_counts is Timer1, unwrapped, at the record's PPS,
+// which is due at replay_second. Until then, there's no PPS.
+static FILE *replay_in;
+static struct frame_stream replay_stream;
+static int replay_started, replay_pending;
+static long replay_second;
+static uint32_t replay_utc; // of the last record
+static uint64_t replay_counts;
+static struct {
+  uint32_t pps, utc, timestamp, span, qe_latency, gsa_latency, rmc_latency;
+  uint16_t adc;
+  char qe[8];
+  uint8_t flags;
+} rec;
+#define RAW_LOCKED 1
+#define RAW_QE 2
+
+volatile uint8_t *sim_adcsra(void) {
+  adcsra &= ~_BV(ADSC); // conversions finish instantly
+  // A pulse that ends while the capture ISR waits on its conversion is
+  // latched then, if the firmware is looking for falling edges. On the
+  // real part, the ISR clears ICF1 before that by writing a one to it.
+  // TIFR1 is plain memory here, so it's cleared here instead.
+  if (capturing) {
+    TIFR1 &= ~_BV(ICF1);
+    if (adc_fall >= 0 && !(TCCR1B & _BV(ICES1))) {
+      ICR1 = adc_fall & 0xffff;
+      TIFR1 |= _BV(ICF1);
+    }
+    adc_fall = -1;
+    capturing = 0;
+  }
+  return &adcsra;
+}
+
+uint16_t sim_adc(void) {
+  // The firmware checks the supply by measuring the 1.1V bandgap
+  // against it. This is what that reads at 5V.
+  if ((ADMUX & 0x0f) == 0x0e) return 225;
+  return adc_phase;
+}
+
+static int in_outage(double t) {
+  return scn.outage_len > 0 && t >= scn.outage_start && t < scn.outage_start + scn.outage_len;
+}
+
+static unsigned long dac_midpoint(void) {
+  return ((1UL << scn.dac_bits) - 1) >> 1;
+}
+
+// The oscillator's frequency error at the start of this second.
+static double osc_freq(void) {
+  double t = sim_second;
+  double y = scn.offset + scn.aging * t / 86400 + sim_rw;
+  if (scn.warmup_tau > 0) y += scn.warmup * exp(-t / scn.warmup_tau);
+  if (scn.step != 0 && t >= scn.step_time) y += scn.step;
+  // Until the firmware first writes it, the DAC sits at midpoint.
+  unsigned long dac = (last_dac_value == 0xffffffff) ? dac_midpoint() : last_dac_value;
+  y += ((double)dac - (double)dac_midpoint()) * scn.dac_ppb;
+  return y;
+}
+
+// Timer 1's count at a time during the current second.
+static double osc_counts(double t) {
+  if (replay_in != NULL) return replay_counts + (t - replay_second) * scn.f_hz;
+  double x = sim_x + sim_y * (t - sim_second);
+  return scn.f_hz * t + scn.f_hz * 1e-9 * x;
+}
+
+static void set_timer(double t) {
+  uint64_t counts = (uint64_t)osc_counts(t);
+  TCNT1 = counts & 0xffff;
+  timer_hibits = counts >> 16;
+  TIFR1 = 0;
+}
+
+// Move the clock, and send as much of the firmware's output as the
+// serial port could have sent in the meantime.
+static void advance(double t) {
+  tx_budget += (t - sim_time) * scn.baud / 10;
+  if (tx_budget > scn.baud / 10) tx_budget = scn.baud / 10;
+  sim_time = t;
+  while(tx_budget >= 1 && (UCSR0B & _BV(UDRIE0))) {
+    USART0_UDRE_vect();
+    if (!(UCSR0B & _BV(UDRIE0))) break; // that call just noticed the buffer was empty
+    if (echo != NULL) fputc(UDR0, echo);
+    tx_budget--;
+  }
+  set_timer(t);
+}
+
+// What the receiver sends after the next PPS, which has to wait until
+// that PPS has been delivered and the main loop has had a look at it.
+static char rx_rest[256];
+static double rx_rest_time[256];
+static int rx_rest_len;
+static double rx_free; // when the receiver's last sentence ends
+
+static void send_char(double t, char c) {
+  advance(t);
+  UDR0 = c;
+  USART0_RX_vect();
+}
+
+// Sentences go out one after another, so one can't start before the
+// last has ended.
+static void send_sentence(double t, const char *body) {
+  char buf[128];
+  unsigned char checksum = 0;
+  for(const char *p = body; *p; p++) checksum ^= *p;
+  snprintf(buf, sizeof(buf), "$%s*%02X\r\n", body, checksum);
+  if (t < sim_time) t = sim_time;
+  if (t < rx_free) t = rx_free;
+  double char_time = 10 / scn.baud;
+  for(int i = 0; buf[i]; i++) {
+    double ct = t + i * char_time;
+    if (ct < sim_second + 1 && rx_rest_len == 0) {
+      send_char(ct, buf[i]);
+    } else if (rx_rest_len < (int)sizeof(rx_rest)) {
+      rx_rest[rx_rest_len] = buf[i];
+      rx_rest_time[rx_rest_len++] = ct;
+    }
+  }
+  rx_free = t + strlen(buf) * char_time;
+}
+
+// The receiver's clock ticks every saw_period ns, and its PPS comes
+// out on the first tick after the true second. That error is the
+// sawtooth, which it reports (give or take qe_scale) as the QE.
+static double sawtooth(long second) {
+  double p = fmod(scn.saw_drift * second, scn.saw_period);
+  return p - scn.saw_period / 2;
+}
+
+// The Timer1 count latched for an edge at t. The noise canceler (ICNC1)
+// delays it by 4 clocks.
+static uint64_t capture_counts(double t) {
+  uint64_t counts = (uint64_t)osc_counts(t);
+  if (TCCR1B & _BV(ICNC1)) counts += 4;
+  return counts;
+}
+
+static void capture(uint64_t counts) {
+  ICR1 = counts & 0xffff;
+  timer_hibits = counts >> 16;
+  TIFR1 = 0;
+  capturing = 1;
+  TIMER1_CAPT_vect();
+  capturing = 0;
+}
+
+// A pulse on the PPS line, with edges at the given Timer1 counts, and
+// the phase detector reading adc at its rising edge. Which edges are
+// captured is up to ICES1, as on the real part. The falling edge comes
+// right after the rising one, rather than in its place among the
+// sentences, but nothing the firmware does depends on that.
+static void pulse_counts(uint64_t rise, uint64_t fall, uint16_t adc) {
+  if (TCCR1B & _BV(ICES1)) {
+    adc_phase = adc;
+    // The conversion takes 13 ADC clocks, at 1/64 of the oscillator.
+    if (fall - rise < 13 * 64) adc_fall = fall;
+    capture(rise);
+    adc_fall = -1;
+  }
+  if (!(TCCR1B & _BV(ICES1))) capture(fall);
+  set_timer(sim_time);
+}
+
+static void pulse(double t, double width, uint16_t adc) {
+  pulse_counts(capture_counts(t), capture_counts(t + width), adc);
+}
+
+static void deliver_pps(long second) {
+  double saw = sawtooth(second);
+  double edge = saw + scn.wpm * rng_gauss();
+  double t = second + edge * 1e-9;
+  advance(second);
+  // The phase detector sees where the edge falls in the oscillator's
+  // cycle, modulo its range.
+  double phase = fmod(sim_x + edge, 1000);
+  if (phase >= 500) phase -= 1000;
+  if (phase < -500) phase += 1000;
+  double reading = 512 - phase + scn.adc_noise * rng_gauss();
+  long adc = lround(reading);
+  if (adc < 0) adc = 0;
+  if (adc > 1023) adc = 1023;
+  adc = lround(reading + adc_error[adc]);
+  if (adc < 0) adc = 0;
+  if (adc > 1023) adc = 1023;
+  pulse(t, scn.pps_width, adc);
+}
+
+// Spurious pulses come at a random time in the second, after the
+// sentences, and the phase detector reads anything at all.
+static void deliver_glitch(long second) {
+  if (scn.glitch_rate <= 0 || rng_uniform() >= scn.glitch_rate) return;
+  double t = second + 0.3 + 0.6 * rng_uniform();
+  advance(t);
+  pulse(t, scn.glitch_width * 1e-9, (uint16_t)(rng_uniform() * 1024));
+}
+
+static void finish(void);
+
+// When the model receiver's $GPRMC starts, after the PPS.
+#define RMC_TIME 0.25
+
+static void send_psti(int fix) {
+  char body[100];
+  if (!fix) return;
+  if (scn.psti_drop > 0 && rng_uniform() < scn.psti_drop) return;
+  snprintf(body, sizeof(body), "PSTI,00,2,0,%.1f,,", -sawtooth(sim_second) / scn.qe_scale);
+  send_sentence(sim_second + scn.psti_time, body);
+}
+
+// Everything that happens in one second, in order.
+enum { EV_PPS, EV_GSA, EV_PSTI, EV_RMC, EV_GLITCH, EV_COUNT };
+static int next_event;
+
+// Read the next 'R' frame of the replay. Returns 0 at the end.
+static int read_record(void) {
+  struct frame f;
+  while(read_frame(&replay_stream, &f, NULL)) {
+    if (f.type != 'R' || f.len < 38) continue;
+    rec.pps = get_u32(f.payload);
+    rec.utc = get_u32(f.payload + 4);
+    rec.timestamp = get_u32(f.payload + 8);
+    rec.span = get_u32(f.payload + 12);
+    rec.qe_latency = get_u32(f.payload + 16);
+    rec.gsa_latency = get_u32(f.payload + 20);
+    rec.rmc_latency = get_u32(f.payload + 24);
+    rec.adc = get_u16(f.payload + 28);
+    memcpy(rec.qe, f.payload + 30, 7);
+    rec.qe[7] = 0;
+    rec.flags = f.payload[37];
+    return 1;
+  }
+  return 0;
+}
+
+// Let the firmware finish what it has to say, and stop.
+static void replay_finish(void) {
+  for(int i = 0; i < 10 && (UCSR0B & _BV(UDRIE0)); i++) advance(sim_time + 1);
+  fflush(stdout);
+  exit(0);
+}
+
+// The replay's version of one second. A record whose span covers more
+// than one second (the PPS was missing) waits for its second, and the
+// receiver has no fix in the meantime.
+static void replay_event(void) {
+  int fix = !replay_pending;
+  switch(next_event) {
+    case EV_PPS:
+      if (!replay_pending) {
+        if (!read_record()) replay_finish();
+        // The timestamps wrap at 32 bits, and so do the spans, after a
+        // few minutes without a PPS. The UTC says how long it really was.
+        if (replay_started) {
+          long seconds = lround(rec.span / scn.f_hz);
+          if (rec.utc != 0 && replay_utc != 0) seconds = rec.utc - replay_utc;
+          if (seconds < 1) seconds = 1;
+          replay_second += seconds;
+          replay_counts += rec.span + 0x100000000LL * llround((seconds * scn.f_hz - rec.span) / 0x100000000LL);
+        } else {
+          replay_second = sim_second;
+          replay_counts = rec.timestamp;
+        }
+        replay_utc = rec.utc;
+        replay_started = replay_pending = 1;
+      }
+      advance(sim_second);
+      if (replay_second > sim_second) break;
+      pulse_counts(replay_counts, replay_counts + (uint64_t)(scn.pps_width * scn.f_hz), rec.adc);
+      replay_pending = 0;
+      break;
+    case EV_GSA: {
+      // The sentences go out in the order they came in, each as long
+      // after the PPS as it did. One that hadn't come by the time the
+      // loop took the PPS (a latency of 0) goes after the $PSTI, so the
+      // loop doesn't see it any sooner here.
+      struct sentence { double t; char body[100]; } sent[3];
+      int n = 0;
+      int qe = fix && (rec.flags & RAW_QE);
+      double late = qe ? rec.qe_latency / scn.f_hz : 0.25;
+      if (qe) {
+        sent[n].t = late;
+        snprintf(sent[n++].body, sizeof(sent[0].body), "PSTI,00,2,0,%s,,", rec.qe);
+      }
+      sent[n].t = rec.gsa_latency ? rec.gsa_latency / scn.f_hz : (qe ? late : 0.05);
+      strcpy(sent[n++].body, fix && (rec.flags & RAW_LOCKED) ? "GPGSA,A,3,02,06,12,24,25,29,,,,,,,1.61,1.33,0.90" : "GPGSA,A,1,,,,,,,,,,,,,,,");
+      // The receiver keeps the time through a gap, without a fix.
+      if (rec.utc != 0) {
+        time_t utc = rec.utc - (replay_second - sim_second);
+        struct tm *tm = gmtime(&utc);
+        sent[n].t = rec.rmc_latency ? rec.rmc_latency / scn.f_hz : late;
+        snprintf(sent[n++].body, sizeof(sent[0].body), "GPRMC,%02d%02d%02d.000,%c,3723.4560,N,12202.2690,W,0.01,180.80,%02d%02d%02d,,,D",
+          tm->tm_hour, tm->tm_min, tm->tm_sec, fix ? 'A' : 'V', tm->tm_mday, tm->tm_mon + 1, tm->tm_year % 100);
+      }
+      // A stable sort, so that ties keep the order above.
+      for(int i = 1; i < n; i++) {
+        for(int j = i; j > 0 && sent[j].t < sent[j - 1].t; j--) {
+          struct sentence swap = sent[j];
+          sent[j] = sent[j - 1];
+          sent[j - 1] = swap;
+        }
+      }
+      for(int i = 0; i < n; i++) send_sentence(sim_second + sent[i].t, sent[i].body);
+      break;
+    }
+  }
+}
+
+void wdt_reset(void) {
+  char body[100];
+  int fix = !in_outage(sim_second);
+
+  if (next_event == EV_GSA) {
+    for(int i = 0; i < rx_rest_len; i++) send_char(rx_rest_time[i], rx_rest[i]);
+    rx_rest_len = 0;
+  }
+
+  if (replay_in != NULL) {
+    replay_event();
+  } else switch(next_event) {
+    case EV_PPS:
+      // The second just gone is finished, so settle it up.
+      if (sim_second > 1) {
+        sim_x += sim_y;
+        sim_rw += scn.rw * rng_gauss();
+      }
+      if (scn.phase_step != 0 && sim_second == (long)scn.phase_step_time) sim_x += scn.phase_step;
+      if (sim_second >= (long)scn.duration) finish();
+      hist_x[sim_second] = sim_x;
+      hist_dac[sim_second] = last_dac_value;
+      hist_mode[sim_second] = (&mode != NULL) ? mode : 0;
+      sim_y = osc_freq();
+      if (fix) deliver_pps(sim_second);
+      else advance(sim_second);
+      break;
+    case EV_GSA:
+      strcpy(body, fix ? "GPGSA,A,3,02,06,12,24,25,29,,,,,,,1.61,1.33,0.90" : "GPGSA,A,1,,,,,,,,,,,,,,,");
+      send_sentence(sim_second + 0.05, body);
+      break;
+    case EV_PSTI:
+      if (scn.psti_time <= RMC_TIME) send_psti(fix);
+      break;
+    case EV_RMC: {
+      // The days count from 2026-01-01.
+      long s = sim_second;
+      int day = 1 + (s / 86400) % 28, month = 1 + (s / (86400 * 28)) % 12;
+      snprintf(body, sizeof(body), "GPRMC,%02ld%02ld%02ld.000,%c,3723.4560,N,12202.2690,W,0.01,180.80,%02d%02d26,,,D",
+        (s / 3600) % 24, (s / 60) % 60, s % 60, fix ? 'A' : 'V', day, month);
+      send_sentence(sim_second + RMC_TIME, body);
+      if (scn.psti_time > RMC_TIME) send_psti(fix); // it comes after the RMC
+      break;
+    }
+    case EV_GLITCH:
+      deliver_glitch(sim_second);
+      break;
+  }
+  if (++next_event == EV_COUNT) {
+    next_event = EV_PPS;
+    sim_second++;
+  }
+}
+
+// Overlapping Allan deviation at tau (in seconds) of the phase history
+// from start to end.
+static double adev(long start, long end, long tau) {
+  long n = end - start;
+  if (n < 2 * tau + 1) return -1;
+  double sum = 0;
+  for(long i = start; i + 2 * tau < end; i++) {
+    double d = hist_x[i + 2 * tau] - 2 * hist_x[i + tau] + hist_x[i];
+    sum += d * d;
+  }
+  sum /= n - 2 * tau;
+  return sqrt(sum / 2) * 1e-9 / tau;
+}
+
+// The phase as the firmware's phase detector sees it. It can only
+// tell the phase modulo its range, so that's what it locks to.
+static double seen_phase(long i) {
+  return hist_x[i] - 1000 * round(hist_x[i] / 1000);
+}
+
+static void finish(void) {
+  long end = (long)scn.duration;
+  long start = scn.metric_start >= 0 ? (long)scn.metric_start : end / 2;
+  if (start >= end) start = 0;
+
+  long fast = -1, settle = 0;
+  unsigned int mode_changes = 0;
+  for(long i = 1; i < end; i++) {
+    if (fast < 0 && hist_mode[i] > 0) fast = i;
+    if (hist_mode[i] != hist_mode[i - 1]) mode_changes++;
+    if (fabs(seen_phase(i)) >= scn.lock_ns) settle = i + 1;
+  }
+  if (settle >= end) settle = -1;
+
+  double sum = 0, sum2 = 0, max = 0, steps = 0;
+  unsigned int moves = 0;
+  for(long i = start; i < end; i++) {
+    double phase = seen_phase(i);
+    sum += phase;
+    sum2 += phase * phase;
+    if (fabs(phase) > max) max = fabs(phase);
+    if (i > start && hist_dac[i] != hist_dac[i - 1]) {
+      moves++;
+      steps += fabs((double)hist_dac[i] - (double)hist_dac[i - 1]);
+    }
+  }
+
+  printf("scenario=%s", scn.name);
+  if (&mode != NULL) printf(" fast_s=%ld", fast);
+  else printf(" fast_s=n/a");
+  printf(" settle_s=%ld mean_ns=%.3f rms_ns=%.3f max_ns=%.3f", settle, sum / (end - start), sqrt(sum2 / (end - start)), max);
+  static const long taus[] = { 1, 10, 100, 1000 };
+  for(int i = 0; i < sizeof(taus) / sizeof(taus[0]); i++)
+    printf(" adev%ld=%.4g", taus[i], adev(start, end, taus[i]));
+  printf(" dac_moves_hr=%.1f dac_step=%.2f", moves * 3600.0 / (end - start), moves ? steps / moves : 0);
+  if (&mode != NULL) printf(" mode_changes=%u", mode_changes);
+  else printf(" mode_changes=n/a");
+  if (&pps_overruns != NULL) printf(" overruns=%u\n", pps_overruns);
+  else printf(" overruns=n/a\n");
+  exit(0);
+}
+
+static int load_scenario(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  const char *base = strrchr(path, '/');
+  base = (base == NULL) ? path : base + 1;
+  snprintf(scn.name, sizeof(scn.name), "%s", base);
+  char *dot = strrchr(scn.name, '.');
+  if (dot != NULL) *dot = 0;
+
+  char line[256];
+  int line_no = 0;
+  while(fgets(line, sizeof(line), f) != NULL) {
+    line_no++;
+    char *p = strchr(line, '#');
+    if (p != NULL) *p = 0;
+    char key[64];
+    double val;
+    if (sscanf(line, " %63[a-z_0-9] = %lf", key, &val) != 2) {
+      if (strspn(line, " \t\r\n") == strlen(line)) continue; // blank
+      fprintf(stderr, "%s:%d: expected key = value\n", path, line_no);
+      fclose(f);
+      return -1;
+    }
+    int found = 0;
+    for(int i = 0; i < sizeof(scn_keys) / sizeof(scn_keys[0]); i++) {
+      if (!strcmp(key, scn_keys[i].key)) {
+        *scn_keys[i].val = val;
+        found = 1;
+      }
+    }
+    if (!strcmp(key, "seed")) {
+      scn.seed = (unsigned long)val;
+      found = 1;
+    } else if (!strcmp(key, "dac_bits")) {
+      scn.dac_bits = (int)val;
+      found = 1;
+    }
+    if (!found) {
+      fprintf(stderr, "%s:%d: unknown key %s\n", path, line_no, key);
+      fclose(f);
+      return -1;
+    }
+  }
+  fclose(f);
+  if (scn.duration < 2 || scn.dac_bits < 8 || scn.dac_bits > 24 || scn.saw_period <= 0 || scn.qe_scale == 0) {
+    fprintf(stderr, "%s: out of range\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  int i = 1;
+  if (i < argc && !strcmp(argv[i], "-v")) {
+    echo = stderr;
+    i++;
+  } else if (i + 1 < argc && !strcmp(argv[i], "-r")) {
+    replay_in = fopen(argv[i + 1], "rb");
+    if (replay_in == NULL) {
+      perror(argv[i + 1]);
+      return 1;
+    }
+    frame_stream_init(&replay_stream, replay_in);
+    echo = stdout;
+    scn.baud = 115200;
+    i += 2;
+  }
+  if ((replay_in != NULL ? i < argc - 1 : i != argc - 1) || (i < argc && argv[i][0] == '-')) {
+    fprintf(stderr, "usage: %s [-v] scenario.scn\n       %s -r capture [scenario.scn]\n", argv[0], argv[0]);
+    return 2;
+  }
+  if (i < argc && load_scenario(argv[i])) return 2;
+  if (&timer_hibits == NULL || &last_dac_value == NULL) {
+    fprintf(stderr, "%s: the firmware has no timer_hibits or last_dac_value\n", argv[0]);
+    return 2;
+  }
+
+  rng_state = scn.seed * 0x9e3779b97f4a7c15ULL + 1;
+  if (scn.adc_dnl > 0)
+    for(int c = 0; c < 1024; c++) adc_error[c] = scn.adc_dnl * rng_gauss();
+  long n = (long)scn.duration + 1;
+  hist_x = calloc(n, sizeof(*hist_x));
+  hist_dac = calloc(n, sizeof(*hist_dac));
+  hist_mode = calloc(n, sizeof(*hist_mode));
+  if (hist_x == NULL || hist_dac == NULL || hist_mode == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  // Start a second in, so that the first capture has a whole second behind it.
+  sim_second = 1;
+  sim_time = 1;
+  sim_x = hist_x[0] = scn.phase0;
+  firmware_main();
+}
@@ -0,0 +1,379 @@
+/*
+
+    GPSDO log smoother
+    Copyright (C) 2015 Nicholas W. Sayer
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+  */
+
+// Works out what the oscillator really did, second by second, from a
+// DEBUG log - as best it can be known after the fact, which is better
+// than the loop could know it at the time. The loop only has the past to
+// go on, but this has the whole log, so it runs a Kalman filter forward
+// over it and then a Rauch-Tung-Striebel smoother back, and each second's
+// estimate draws on the seconds after it as well as the ones before.
+//
+// The oscillator is modeled as its phase against GPS (ns), its frequency
+// error with the DAC at midpoint (ppb) and the drift of that (ppb/s),
+// each with its own noise. The DAC values from the log are put back in as
+// a known input, so the frequency that comes out is the oscillator's own,
+// free of the loop's steering. The measurement is the phase the firmware
+// saw: the cycle count errors (SB=) chained together in 100 ns steps, and
+// the phase detector (RPE=) with the QE correction for the nanoseconds,
+// unwrapped against each other the same way MEASURE does it.
+//
+// It prints one line per second:
+//
+//   <utc> <phase ns> <phase sd> <freq ppb> <freq sd> <free running freq ppb>
+//
+// where freq is the frequency error during the second that starts there,
+// steering and all, and free running freq is what it would have been
+// with the DAC at midpoint. The phase is in the sense of CPE (less any
+// dither), and the lines join on utc with TS=, so this is the reference
+// to score a loop's own idea of the phase and frequency against - the
+// unit's, or a variant's replayed from the same capture (gpsdo_sim -r).
+//
+// The records used are the ones with RPE=, QE= and DAC=. Where one
+// follows on from the last (one second later, or more with an XXS=), its
+// SB= says how far the phase moved. Across a gap of up to a minute (an
+// FR, a record lost to a busy serial port), the phase is taken to have
+// gone where the frequency was taking it. A longer gap (warm-up, the log
+// stepping down) ends a run and starts a new one, with a new phase
+// origin. The seconds in a gap are filled in from the model, with a
+// larger sd.
+//
+// usage: gpsdo_smooth [-m meas ns] [-w wfm ns] [-k rwfm ppb] [-a drift ppb/s]
+//                     [-g ppb per DAC step] [-b DAC bits] [log]
+//
+// -m, -w, -k and -a are the standard deviations, per second, of the
+// measurement noise (the receiver's PPS after the QE correction and the
+// phase detector), of the white frequency noise, of the random walk
+// frequency noise and of the change in the drift. The defaults suit an
+// OH300 with a SkyTraq receiver, and so do -g and -b (1/267 ppb per step
+// of an 18 bit DAC). The RMS of the measurements against the smoothed
+// phase is printed at the end; if it's far from -m, the noise settings
+// don't fit the unit.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// As in the firmware.
+#define F_OSC 10000000L
+#define QE_COMPENSATION 1.5
+#define PHASE_WRAP 1000
+
+// The longest gap in the records that a run carries on across, and
+// how far back to look for the frequency to do it with.
+#define MAX_GAP 60
+#define SLOPE_SECONDS 16
+
+#define N 3 // phase, frequency, drift
+
+typedef double vec[N];
+typedef double mat[N][N];
+
+// One second of a run.
+struct second {
+  unsigned long utc;
+  double z; // the measured phase, if has_z
+  double u; // the DAC's share of the frequency error, from here to the next second
+  unsigned char has_z;
+  vec x_pred, x; // the forward prediction and estimate (then the smoothed estimate)
+  mat p_pred, p;
+};
+
+static double meas_sd = 3, wfm_sd = 0.01, rwfm_sd = 0.001, drift_sd = 1e-8;
+static double dac_ppb = 1.0 / 267;
+static int dac_bits = 18;
+
+static struct second *run;
+static long run_len, run_size;
+
+// The residual, over all of the runs.
+static double resid_sum2;
+static unsigned long resid_count, run_count;
+
+static void mat_mul(mat out, mat a, mat b) {
+  mat t;
+  for(int i = 0; i < N; i++)
+    for(int j = 0; j < N; j++) {
+      t[i][j] = 0;
+      for(int k = 0; k < N; k++) t[i][j] += a[i][k] * b[k][j];
+    }
+  memcpy(out, t, sizeof(t));
+}
+
+static void mat_transpose(mat out, mat a) {
+  for(int i = 0; i < N; i++)
+    for(int j = 0; j < N; j++) out[i][j] = a[j][i];
+}
+
+// Only the covariances get inverted, and they're positive definite, so
+// there's no need to pivot.
+static void mat_invert(mat out, mat a) {
+  double aug[N][2 * N];
+  for(int i = 0; i < N; i++)
+    for(int j = 0; j < N; j++) {
+      aug[i][j] = a[i][j];
+      aug[i][N + j] = (i == j);
+    }
+  for(int i = 0; i < N; i++) {
+    double d = aug[i][i];
+    for(int j = 0; j < 2 * N; j++) aug[i][j] /= d;
+    for(int k = 0; k < N; k++) {
+      if (k == i) continue;
+      double f = aug[k][i];
+      for(int j = 0; j < 2 * N; j++) aug[k][j] -= f * aug[i][j];
+    }
+  }
+  for(int i = 0; i < N; i++)
+    for(int j = 0; j < N; j++) out[i][j] = aug[i][N + j];
+}
+
+// The state a second on: the phase gains the second's frequency error
+// (the DAC's share included) and the frequency gains the drift.
+static mat F = { { 1, 1, 0 }, { 0, 1, 1 }, { 0, 0, 1 } };
+
+static void predict(struct second *from, struct second *to) {
+  to->x_pred[0] = from->x[0] + from->x[1] + from->u;
+  to->x_pred[1] = from->x[1] + from->x[2];
+  to->x_pred[2] = from->x[2];
+  mat ft;
+  mat_transpose(ft, F);
+  mat_mul(to->p_pred, F, from->p);
+  mat_mul(to->p_pred, to->p_pred, ft);
+  to->p_pred[0][0] += wfm_sd * wfm_sd;
+  to->p_pred[1][1] += rwfm_sd * rwfm_sd;
+  to->p_pred[2][2] += drift_sd * drift_sd;
+}
+
+// Only the phase is measured, so the update is a scalar one.
+static void update(struct second *s) {
+  memcpy(s->x, s->x_pred, sizeof(vec));
+  memcpy(s->p, s->p_pred, sizeof(mat));
+  if (!s->has_z) return;
+  double innov = s->z - s->x_pred[0];
+  double var = s->p_pred[0][0] + meas_sd * meas_sd;
+  vec k;
+  for(int i = 0; i < N; i++) k[i] = s->p_pred[i][0] / var;
+  for(int i = 0; i < N; i++) s->x[i] += k[i] * innov;
+  for(int i = 0; i < N; i++)
+    for(int j = 0; j < N; j++) s->p[i][j] = s->p_pred[i][j] - k[i] * s->p_pred[0][j];
+}
+
+static void smooth_run(void) {
+  if (run_len == 0) return;
+  run_count++;
+
+  // The first measurement sets the phase. Nothing is known about the
+  // frequency, beyond it being within the oscillator's tuning range.
+  struct second *s = &run[0];
+  memset(s->x_pred, 0, sizeof(vec));
+  memset(s->p_pred, 0, sizeof(mat));
+  s->x_pred[0] = s->z;
+  s->p_pred[0][0] = 1e6;
+  s->p_pred[1][1] = 1e6;
+  s->p_pred[2][2] = 1e-6;
+  update(s);
+
+  for(long i = 1; i < run_len; i++) {
+    predict(&run[i - 1], &run[i]);
+    update(&run[i]);
+  }
+
+  // Back from the end: x(i) += C (x(i+1) - x_pred(i+1)), with
+  // C = P(i) F' P_pred(i+1)^-1, and P likewise.
+  mat ft;
+  mat_transpose(ft, F);
+  for(long i = run_len - 2; i >= 0; i--) {
+    struct second *s = &run[i], *next = &run[i + 1];
+    mat c, ct, inv, t;
+    mat_invert(inv, next->p_pred);
+    mat_mul(c, s->p, ft);
+    mat_mul(c, c, inv);
+    vec dx;
+    for(int j = 0; j < N; j++) dx[j] = next->x[j] - next->x_pred[j];
+    for(int j = 0; j < N; j++)
+      for(int k = 0; k < N; k++) s->x[j] += c[j][k] * dx[k];
+    mat dp;
+    for(int j = 0; j < N; j++)
+      for(int k = 0; k < N; k++) dp[j][k] = next->p[j][k] - next->p_pred[j][k];
+    mat_transpose(ct, c);
+    mat_mul(t, c, dp);
+    mat_mul(t, t, ct);
+    for(int j = 0; j < N; j++)
+      for(int k = 0; k < N; k++) s->p[j][k] += t[j][k];
+  }
+
+  for(long i = 0; i < run_len; i++) {
+    struct second *s = &run[i];
+    printf("%lu %.3f %.3f %.6f %.6f %.6f\n", s->utc, s->x[0], sqrt(fmax(s->p[0][0], 0)), s->x[1] + s->u,
+      sqrt(fmax(s->p[1][1], 0)), s->x[1]);
+    if (s->has_z) {
+      resid_sum2 += (s->z - s->x[0]) * (s->z - s->x[0]);
+      resid_count++;
+    }
+  }
+  run_len = 0;
+}
+
+static struct second *add_second(unsigned long utc) {
+  if (run_len == run_size) {
+    run_size = run_size ? run_size * 2 : 4096;
+    run = realloc(run, run_size * sizeof(*run));
+    if (run == NULL) {
+      perror("realloc");
+      exit(1);
+    }
+  }
+  struct second *s = &run[run_len++];
+  memset(s, 0, sizeof(*s));
+  s->utc = utc;
+  return s;
+}
+
+// What's been read of the current record.
+static struct {
+  unsigned long utc;
+  long sb, xxs;
+  double rpe, qe;
+  unsigned long dac;
+  unsigned char has_sb, has_rpe, has_qe, has_dac;
+} rec;
+
+// Where the last run stands.
+static unsigned long last_utc;
+static double last_fine;
+static long wraps;
+
+// The run's frequency lately (steering and all), from its measurements
+// over the last SLOPE_SECONDS or so. Returns 0 if there aren't two yet.
+static int recent_slope(double *slope) {
+  struct second *last = &run[run_len - 1], *first = NULL;
+  for(long i = run_len - 2; i >= 0 && last->utc - run[i].utc <= SLOPE_SECONDS; i--)
+    if (run[i].has_z) first = &run[i];
+  if (first == NULL) return 0;
+  *slope = (last->z - first->z) / (last->utc - first->utc);
+  return 1;
+}
+
+static void end_record(void) {
+  if (rec.utc == 0 || !(rec.has_rpe && rec.has_qe && rec.has_dac)) return;
+  double fine = rec.rpe + QE_COMPENSATION * rec.qe;
+  double u = (rec.dac - (double)(1L << (dac_bits - 1))) * dac_ppb;
+  double slope;
+  if (run_len > 0 && rec.has_sb && rec.utc == last_utc + 1 + rec.xxs) {
+    // The cycle count covers the whole span, so it says how many
+    // times the phase detector wrapped.
+    double coarse_step = (1000000000.0 / F_OSC) * rec.sb;
+    wraps += lround((coarse_step - (fine - last_fine)) / PHASE_WRAP);
+  } else if (run_len > 0 && rec.utc > last_utc && rec.utc - last_utc <= MAX_GAP && recent_slope(&slope)) {
+    // Records are missing, so the cycle count doesn't span the gap.
+    // The phase can't have gone far from where the frequency was
+    // taking it, though, so go by that.
+    double predicted = run[run_len - 1].z + slope * (rec.utc - last_utc);
+    wraps = lround((predicted - fine) / PHASE_WRAP);
+  } else {
+    smooth_run();
+    wraps = 0;
+  }
+  // The seconds in between go without a measurement. Whatever the DAC
+  // did in them wasn't logged, so it's taken to have stayed put.
+  for(unsigned long t = last_utc + 1; run_len > 0 && t < rec.utc; t++) {
+    struct second *s = add_second(t);
+    s->u = run[run_len - 2].u;
+  }
+  struct second *s = add_second(rec.utc);
+  s->z = fine + wraps * (double)PHASE_WRAP;
+  s->has_z = 1;
+  s->u = u;
+  last_utc = rec.utc;
+  last_fine = fine;
+}
+
+int main(int argc, char **argv) {
+  int i;
+  for(i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != 0; i++) {
+    if (!strcmp(argv[i], "-m") && i + 1 < argc) {
+      meas_sd = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-w") && i + 1 < argc) {
+      wfm_sd = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-k") && i + 1 < argc) {
+      rwfm_sd = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-a") && i + 1 < argc) {
+      drift_sd = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-g") && i + 1 < argc) {
+      dac_ppb = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "-b") && i + 1 < argc) {
+      dac_bits = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [-m meas ns] [-w wfm ns] [-k rwfm ppb] [-a drift ppb/s]\n"
+        "       %*s [-g ppb per DAC step] [-b DAC bits] [log]\n", argv[0], (int)strlen(argv[0]), "");
+      return 2;
+    }
+  }
+  if (meas_sd <= 0 || dac_bits < 2 || dac_bits > 31) {
+    fprintf(stderr, "-m has to be more than 0, and -b from 2 to 31\n");
+    return 2;
+  }
+  FILE *in = stdin;
+  if (i < argc) {
+    in = fopen(argv[i], "r");
+    if (in == NULL) {
+      perror(argv[i]);
+      return 1;
+    }
+  }
+
+  // A record runs from one TS= line to the next.
+  char line[256];
+  while(fgets(line, sizeof(line), in) != NULL) {
+    line[strcspn(line, "\r\n")] = 0;
+    char *eq = strchr(line, '=');
+    if (eq == NULL) continue;
+    *eq = 0;
+    char *value = eq + 1, *end;
+    if (!strcmp(line, "TS")) {
+      end_record();
+      memset(&rec, 0, sizeof(rec));
+      rec.utc = strtoul(value, &end, 10);
+    } else if (!strcmp(line, "SB")) {
+      rec.sb = strtol(value, &end, 10);
+      rec.has_sb = (end != value);
+    } else if (!strcmp(line, "RPE")) {
+      rec.rpe = strtod(value, &end);
+      rec.has_rpe = (end != value);
+    } else if (!strcmp(line, "QE")) {
+      rec.qe = strtod(value, &end);
+      rec.has_qe = (end != value && isfinite(rec.qe));
+    } else if (!strcmp(line, "DAC")) {
+      rec.dac = strtoul(value, &end, 16);
+      rec.has_dac = (end != value);
+    } else if (!strcmp(line, "XXS")) {
+      rec.xxs = strtol(value, &end, 10);
+    } else if (!strcmp(line, "XXI")) {
+      rec.has_sb = 0; // the firmware threw this one out
+    }
+  }
+  end_record();
+  smooth_run();
+  if (resid_count > 0)
+    fprintf(stderr, "%lu seconds in %lu runs, measurement RMS against the smoothed phase %.3f ns\n",
+      resid_count, run_count, sqrt(resid_sum2 / resid_count));
+  return 0;
+}
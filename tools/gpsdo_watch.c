@@ -0,0 +1,338 @@
+/*
+
+    GPSDO log change-point watcher
+    Copyright (C) 2015 Nicholas W. Sayer
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+  */
+
+// Watches the DEBUG logs of any number of units as they come in (from
+// files, pipes or FIFOs - one per unit, named for the file) and reports
+// changes in their behavior as they happen, one line per change:
+//
+//   <unit> <utc> <detector> <up|down> since=<utc> before=<baseline> sd=<spread>
+//
+// utc is when the change was detected, and since= is when it started,
+// which is the second the detector's sum last left zero. The detectors
+// are CUSUMs, each costing the same small, fixed amount per record:
+//
+//   CPE - the phase error stepped (an antenna or receiver problem, or
+//         the oscillator jumped). This watches the change in CPE from
+//         one second to the next, since the phase error itself wanders
+//         with the loop.
+//   DAC_SLOPE - the rate the DAC is moving at (over a minute) changed,
+//         which is the loop following a change in the oscillator's
+//         frequency.
+//   QE - the receiver's sawtooth got bigger or smaller.
+//   XX_RATE - XXI / XXS (bad or missed PPS) became more common.
+//
+// CPE and DAC_SLOPE only watch the PLL (MOD= 1 and up), and start over
+// when the mode changes, since the time constant changes how both
+// behave. After it reports a change, a detector relearns its baseline,
+// so that one change is reported once.
+//
+// usage: gpsdo_watch log...
+//
+// A log of "-" is stdin. Regular files are followed, like tail -f: at
+// the end of one, it waits for more to be written.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/stat.h>
+
+// How many records a detector learns its baseline from, and the time
+// constant it tracks it with after that (in records).
+#define LEARN 600
+#define BASE_TAU 3600.0
+// The CUSUM's slack and threshold, in standard deviations.
+#define CUSUM_K 0.5
+#define CUSUM_H 12.0
+// For XX_RATE: the least rate we'll take as the baseline (per record),
+// how many times more common they have to get, and the threshold
+// (a log likelihood ratio).
+#define RATE_FLOOR (1.0 / 3600)
+#define RATE_FACTOR 10.0
+#define RATE_H 6.0
+
+// DAC_SLOPE's block length, in records, and its threshold. The DAC
+// follows the oscillator's own random walk, so it takes more to be sure.
+#define SLOPE_BLOCK 60
+#define SLOPE_H 20.0
+
+#define LINE_LEN 256
+#define READ_LEN 4096
+// How often to look for more in a file that's being followed, in ms.
+#define FOLLOW_MS 250
+
+enum { DET_CPE, DET_DAC_SLOPE, DET_QE, DET_XX_RATE, DETECTORS };
+static const char *det_names[DETECTORS] = { "CPE", "DAC_SLOPE", "QE", "XX_RATE" };
+static const double det_h[DETECTORS] = { CUSUM_H, SLOPE_H, CUSUM_H, RATE_H };
+
+struct detector {
+  unsigned long seen;
+  double mean, var; // the baseline
+  double hi, lo; // the sums. XX_RATE only uses hi.
+  unsigned long hi_start, lo_start;
+};
+
+struct unit {
+  const char *name;
+  int fd;
+  unsigned char follow; // a regular file, which poll() can't wait on
+  char line[LINE_LEN];
+  int line_len;
+  // The record being read.
+  unsigned long utc;
+  double cpe, dac, qe;
+  int mode;
+  unsigned char has_cpe, has_dac, has_qe, has_xx;
+  // From the ones before it.
+  unsigned long last_utc;
+  double last_cpe, block_dac;
+  int last_mode, block_len;
+  unsigned char has_last_cpe, has_block;
+  struct detector det[DETECTORS];
+};
+
+static void report(const struct unit *u, int det, const char *dir, unsigned long since, double before, double sd) {
+  printf("%s %lu %s %s since=%lu before=%.6g sd=%.6g\n", u->name, u->utc, det_names[det], dir, since, before, sd);
+  fflush(stdout);
+}
+
+static void relearn(struct detector *d) {
+  memset(d, 0, sizeof(*d));
+}
+
+// A two-sided CUSUM for a shift in the mean, in units of the baseline's
+// standard deviation. The baseline only follows the data while neither
+// sum is building, so a slow change can't drag it along.
+static void cusum(struct unit *u, int det, double x) {
+  struct detector *d = &(u->det[det]);
+  if (d->seen < LEARN) {
+    // Learn the baseline as a straight average (Welford), to start.
+    d->seen++;
+    double delta = x - d->mean;
+    d->mean += delta / d->seen;
+    d->var += (delta * (x - d->mean) - d->var) / d->seen;
+    return;
+  }
+  double sd = sqrt(d->var);
+  if (sd < 1e-6) sd = 1e-6; // a flat baseline
+  double z = (x - d->mean) / sd;
+
+  if (d->hi == 0) d->hi_start = u->utc;
+  if (d->lo == 0) d->lo_start = u->utc;
+  d->hi = fmax(0, d->hi + z - CUSUM_K);
+  d->lo = fmax(0, d->lo - z - CUSUM_K);
+  if (d->hi > det_h[det] || d->lo > det_h[det]) {
+    int up = d->hi > det_h[det];
+    report(u, det, up ? "up" : "down", up ? d->hi_start : d->lo_start, d->mean, sd);
+    relearn(d);
+    return;
+  }
+  if (d->hi == 0 && d->lo == 0) {
+    double delta = x - d->mean;
+    d->mean += delta / BASE_TAU;
+    d->var += (delta * delta - d->var) / BASE_TAU;
+  }
+}
+
+// A Bernoulli CUSUM for a rise in how often something happens.
+static void rate_cusum(struct unit *u, int det, int happened) {
+  struct detector *d = &(u->det[det]);
+  double p0 = d->mean;
+  if (d->seen < LEARN) {
+    d->seen++;
+    d->mean += (happened - d->mean) / d->seen;
+    return;
+  }
+  if (p0 < RATE_FLOOR) p0 = RATE_FLOOR;
+  double p1 = p0 * RATE_FACTOR;
+  if (p1 > 0.5) p1 = 0.5;
+  if (p1 <= p0) return; // it's already happening half the time
+
+  if (d->hi == 0) d->hi_start = u->utc;
+  d->hi = fmax(0, d->hi + (happened ? log(p1 / p0) : log((1 - p1) / (1 - p0))));
+  if (d->hi > det_h[det]) {
+    report(u, det, "up", d->hi_start, p0 * 3600, 0); // per hour
+    relearn(d);
+    return;
+  }
+  if (d->hi == 0) d->mean += (happened - d->mean) / BASE_TAU;
+}
+
+static void end_record(struct unit *u) {
+  if (u->utc == 0) return;
+  if (u->mode != u->last_mode) {
+    relearn(&(u->det[DET_CPE]));
+    relearn(&(u->det[DET_DAC_SLOPE]));
+    u->has_last_cpe = u->has_block = 0;
+    u->last_mode = u->mode;
+  }
+  int consecutive = (u->utc == u->last_utc + 1);
+  u->last_utc = u->utc;
+  if (u->mode > 0) {
+    if (u->has_cpe) {
+      if (u->has_last_cpe && consecutive) cusum(u, DET_CPE, u->cpe - u->last_cpe);
+      u->last_cpe = u->cpe;
+    }
+    u->has_last_cpe = u->has_cpe;
+    if (u->has_dac) {
+      if (!u->has_block) {
+        u->block_dac = u->dac;
+        u->block_len = 0;
+        u->has_block = 1;
+      } else if (++u->block_len == SLOPE_BLOCK) {
+        cusum(u, DET_DAC_SLOPE, (u->dac - u->block_dac) / SLOPE_BLOCK);
+        u->block_dac = u->dac;
+        u->block_len = 0;
+      }
+    }
+  }
+  if (u->has_qe) cusum(u, DET_QE, fabs(u->qe));
+  rate_cusum(u, DET_XX_RATE, u->has_xx);
+}
+
+static void handle_line(struct unit *u, char *line) {
+  char *eq = strchr(line, '=');
+  if (eq == NULL) return;
+  *eq = 0;
+  char *value = eq + 1, *end;
+  if (!strcmp(line, "TS")) {
+    end_record(u);
+    u->utc = strtoul(value, &end, 10);
+    u->has_cpe = u->has_dac = u->has_qe = u->has_xx = 0;
+    // MOD= comes after this record's TS=. Until it does, assume no change.
+    u->mode = u->last_mode;
+    return;
+  }
+  if (!strcmp(line, "XXI") || !strcmp(line, "XXS")) {
+    u->has_xx = 1;
+    return;
+  }
+  double v = strtod(value, &end); // DAC is in hex, which strtod takes
+  if (end == value || !isfinite(v)) return;
+  if (!strcmp(line, "CPE")) {
+    u->cpe = v;
+    u->has_cpe = 1;
+  } else if (!strcmp(line, "DAC")) {
+    u->dac = v;
+    u->has_dac = 1;
+  } else if (!strcmp(line, "MOD")) {
+    u->mode = (int)v;
+  } else if (!strcmp(line, "QE")) {
+    u->qe = v;
+    u->has_qe = 1;
+  }
+}
+
+// Returns 1 if it read something, 0 if there's nothing to read yet, and
+// -1 when the unit is done.
+static int read_unit(struct unit *u) {
+  char buf[READ_LEN];
+  ssize_t n = read(u->fd, buf, sizeof(buf));
+  if (n < 0 && (errno == EAGAIN || errno == EINTR)) return 0;
+  if (n == 0 && u->follow) return 0; // the rest hasn't been written yet
+  if (n <= 0) {
+    if (n < 0) perror(u->name);
+    end_record(u);
+    return -1;
+  }
+  for(ssize_t i = 0; i < n; i++) {
+    if (buf[i] == '\r' || buf[i] == '\n') {
+      u->line[u->line_len] = 0;
+      if (u->line_len > 0) handle_line(u, u->line);
+      u->line_len = 0;
+    } else if (u->line_len < LINE_LEN - 1) {
+      u->line[u->line_len++] = buf[i];
+    }
+  }
+  return 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s log...\n", argv[0]);
+    return 2;
+  }
+  int count = argc - 1, follow_count = 0;
+  struct unit *units = calloc(count, sizeof(*units));
+  struct pollfd *fds = calloc(count, sizeof(*fds));
+  if (units == NULL || fds == NULL) {
+    perror("calloc");
+    return 1;
+  }
+  for(int i = 0; i < count; i++) {
+    const char *path = argv[i + 1];
+    struct unit *u = &units[i];
+    if (!strcmp(path, "-")) {
+      u->name = "stdin";
+      u->fd = 0;
+    } else {
+      const char *base = strrchr(path, '/');
+      u->name = (base == NULL) ? path : base + 1;
+      // Opening a FIFO for reading waits for a writer. Don't, but
+      // go back to blocking reads, which are only done when poll()
+      // says there's something to read.
+      u->fd = open(path, O_RDONLY | O_NONBLOCK);
+      if (u->fd < 0) {
+        perror(path);
+        return 1;
+      }
+      fcntl(u->fd, F_SETFL, 0);
+    }
+    struct stat st;
+    u->follow = fstat(u->fd, &st) == 0 && S_ISREG(st.st_mode);
+    // A regular file always polls as readable, even at its end, so
+    // those are left out of the poll and read every FOLLOW_MS instead.
+    fds[i].fd = u->follow ? -1 : u->fd;
+    fds[i].events = POLLIN;
+    if (u->follow) follow_count++;
+  }
+
+  int open_count = count;
+  while(open_count > 0) {
+    if (poll(fds, count, (follow_count > 0) ? FOLLOW_MS : -1) < 0) {
+      if (errno == EINTR) continue;
+      perror("poll");
+      return 1;
+    }
+    for(int i = 0; i < count; i++) {
+      int status;
+      if (units[i].follow) {
+        while((status = read_unit(&units[i])) > 0) ;
+      } else {
+        if (fds[i].fd < 0 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+        status = read_unit(&units[i]);
+      }
+      if (status < 0) {
+        if (units[i].fd != 0) close(units[i].fd);
+        if (units[i].follow) follow_count--;
+        units[i].follow = 0;
+        units[i].fd = -1;
+        fds[i].fd = -1; // poll() skips these
+        open_count--;
+      }
+    }
+  }
+  return 0;
+}
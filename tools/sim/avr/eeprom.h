@@ -0,0 +1,7 @@
+// EEMEM variables are just RAM, and start out zeroed, which none of the
+// firmware's magic numbers match. So every run starts from a blank EEPROM.
+#include <string.h>
+#define EEMEM
+#define eeprom_read_block(dst, src, n) memcpy((dst), (src), (n))
+#define eeprom_update_block(src, dst, n) memcpy((dst), (src), (n))
+#define eeprom_update_byte(dst, v) (*(dst) = (v))
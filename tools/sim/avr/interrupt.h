@@ -0,0 +1,5 @@
+// ISRs are plain functions that the simulator calls.
+#define ISR(vector, ...) void vector(void)
+#define ISR_NAKED
+#define sei()
+#define cli()
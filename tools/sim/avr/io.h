@@ -0,0 +1,92 @@
+// The registers the firmware uses, as plain variables (defined in
+// gpsdo_sim.c). The ADC is special: reading ADCSRA finishes any
+// conversion that was started, and ADC returns whatever the simulator
+// says the selected input is.
+
+#include <stdint.h>
+
+#define _BV(b) (1U << (b))
+
+#define SIM_REGS8(R) \
+  R(PORTB) R(PORTD) R(DDRB) R(DDRD) R(PINB) R(PIND) \
+  R(SPDR0) R(SPSR0) R(SPCR0) R(TIFR1) R(ADMUX) R(DIDR0) R(ACSR) \
+  R(UDR0) R(UCSR0A) R(UCSR0B) R(UCSR0C) R(UBRR0H) R(UBRR0L) \
+  R(TCCR1A) R(TCCR1B) R(TCCR1C) R(TIMSK1) R(PRR0) R(PRR1) R(MCUSR) R(WDTCSR) R(SREG)
+#define SIM_REGS16(R) R(ICR1) R(TCNT1)
+
+#define SIM_DECLARE(n) extern volatile uint8_t n;
+#define SIM_DECLARE16(n) extern volatile uint16_t n;
+SIM_REGS8(SIM_DECLARE)
+SIM_REGS16(SIM_DECLARE16)
+// The stack pointer is only read to find the stack, so it's as wide as a
+// pointer here.
+extern volatile uintptr_t SP;
+
+volatile uint8_t *sim_adcsra(void);
+uint16_t sim_adc(void);
+#define ADCSRA (*sim_adcsra())
+#define ADC (sim_adc())
+
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define PORTD2 2
+#define PORTD3 3
+#define PINB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define DDD2 2
+#define DDD3 3
+#define SPIF0 7
+#define SPE0 6
+#define MSTR0 4
+#define CPOL0 3
+#define SPI2X0 0
+#define TOV1 0
+#define ICF1 5
+#define ADSC 6
+#define ADEN 7
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define REFS0 6
+#define REFS1 7
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define ADC0D 0
+#define ACD 7
+#define RXCIE0 7
+#define RXEN0 4
+#define TXEN0 3
+#define UDRIE0 5
+#define UCSZ00 1
+#define UCSZ01 2
+#define U2X 1
+#define ICES1 6
+#define ICNC1 7
+#define CS10 0
+#define ICIE1 5
+#define TOIE1 0
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI0 7
+#define PRSPI0 2
+#define PRUSART1 4
+#define PRTIM3 3
+#define PRSPI1 2
+#define PRTIM4 5
+#define PRPTC 4
+#define PRTWI1 6
+#define PORF 0
+#define EXTRF 1
+#define BORF 2
+#define WDRF 3
+#define WDIE 6
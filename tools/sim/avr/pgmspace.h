@@ -0,0 +1,13 @@
+// There's only one address space here.
+#include <string.h>
+#include <stdint.h>
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+// The host's ints and longs are wider than the AVR's, so read the
+// variable as whatever type it is.
+#define pgm_read_word(p) (*(p))
+#define pgm_read_dword(p) (*(p))
+#define strlen_P strlen
+#define strncmp_P strncmp
+#define strchr_P strchr
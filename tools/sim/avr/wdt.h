@@ -0,0 +1,5 @@
+// The firmware pets the watchdog once per pass of its main loop, so this
+// is where the simulator gets control. See gpsdo_sim.c.
+void wdt_reset(void);
+#define wdt_enable(timeout)
+#define WDTO_500MS 5
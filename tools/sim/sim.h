@@ -0,0 +1,20 @@
+// Forced into the firmware (with -include) when it's built for the
+// simulator. See gpsdo_sim.c.
+
+// avr-libc gets offsetof() in along the way; glibc doesn't.
+#include <stddef.h>
+
+#define __ATTR_NORETURN__ __attribute__((noreturn))
+
+// The firmware's only inline assembly is in the watchdog ISR (with
+// STALL_TRACE), which never runs in the simulator. Its one instruction
+// is made an assembler macro that expands to nothing, so the firmware
+// (older copies included) builds as it is.
+__asm__(".macro clr reg\n.endm");
+
+// avr-libc's non-standard conversions. gpsdo_sim.c has them.
+char *dtostrf(double val, signed char width, unsigned char prec, char *buf);
+char *itoa(int val, char *buf, int radix);
+char *ltoa(long val, char *buf, int radix);
+char *utoa(unsigned int val, char *buf, int radix);
+char *ultoa(unsigned long val, char *buf, int radix);
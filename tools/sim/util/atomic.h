@@ -0,0 +1,3 @@
+// Nothing interrupts anything in the simulator.
+#define ATOMIC_BLOCK(type) for(int sim_atomic = 1; sim_atomic; sim_atomic = 0)
+#define ATOMIC_RESTORESTATE 0
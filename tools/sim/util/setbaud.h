@@ -0,0 +1,3 @@
+#define UBRRH_VALUE 0
+#define UBRRL_VALUE 0
+#define USE_2X 0